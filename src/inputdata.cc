@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -61,6 +62,11 @@
 #define S_IRUSR _S_IREAD
 #define S_IWUSR _S_IWRITE
 #endif
+#else
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #endif
 
 using std::istream;
@@ -71,8 +77,96 @@ using std::ostream;
 using std::endl;
 using std::ios;
 
+SymbolTable::SymbolTable()
+:
+	buckets( 64, -1 )
+{
+#ifndef _WIN32
+	pthread_mutex_init( &mutex, 0 );
+#endif
+}
+
+SymbolTable::~SymbolTable()
+{
+#ifndef _WIN32
+	pthread_mutex_destroy( &mutex );
+#endif
+}
+
+/* FNV-1a. */
+unsigned long SymbolTable::hash( const std::string &name )
+{
+	unsigned long h = 2166136261ul;
+	for ( size_t i = 0; i < name.size(); i++ ) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619ul;
+	}
+	return h;
+}
+
+int SymbolTable::lookup( const std::string &name, unsigned long h )
+{
+	int sym = buckets[h & ( buckets.size() - 1 )];
+	while ( sym >= 0 && ( symbols[sym].hash != h || symbols[sym].name != name ) )
+		sym = symbols[sym].next;
+	return sym;
+}
+
+/* Double the buckets and chain the symbols again. */
+void SymbolTable::rehash()
+{
+	buckets.assign( buckets.size() * 2, -1 );
+	for ( size_t sym = 0; sym < symbols.size(); sym++ ) {
+		int &head = buckets[symbols[sym].hash & ( buckets.size() - 1 )];
+		symbols[sym].next = head;
+		head = sym;
+	}
+}
+
+int SymbolTable::intern( const std::string &name )
+{
+	unsigned long h = hash( name );
+#ifndef _WIN32
+	pthread_mutex_lock( &mutex );
+#endif
+	int sym = lookup( name, h );
+	if ( sym < 0 ) {
+		if ( symbols.size() >= buckets.size() )
+			rehash();
+
+		int &head = buckets[h & ( buckets.size() - 1 )];
+		Symbol symbol;
+		symbol.name = name;
+		symbol.hash = h;
+		symbol.next = head;
+		sym = symbols.size();
+		symbols.push_back( symbol );
+		head = sym;
+	}
+#ifndef _WIN32
+	pthread_mutex_unlock( &mutex );
+#endif
+	return sym;
+}
+
+/* Returns -1 if the name has never been interned. */
+int SymbolTable::find( const std::string &name )
+{
+	unsigned long h = hash( name );
+#ifndef _WIN32
+	pthread_mutex_lock( &mutex );
+#endif
+	int sym = lookup( name, h );
+#ifndef _WIN32
+	pthread_mutex_unlock( &mutex );
+#endif
+	return sym;
+}
+
 InputData::~InputData()
 {
+	unmapInput();
+
 	inputItems.empty();
 	parseDataList.empty();
 	sectionList.empty();
@@ -92,11 +186,61 @@ InputData::~InputData()
 	if ( histogramFn != 0 )
 		::free( (void*)histogramFn );
 
-	if ( histogram != 0 )
-		delete[] histogram;
+	if ( inputCorpusFn != 0 )
+		::free( (void*)inputCorpusFn );
+
+	if ( autoStyleCorpus != 0 )
+		::free( (void*)autoStyleCorpus );
+
+	if ( corpusCounts != 0 )
+		delete[] corpusCounts;
+
+	if ( corpusPairs != 0 )
+		delete[] corpusPairs;
 
 	for ( ArgsVector::Iter bl = breadthLabels; bl.lte(); bl++ )
 		free( (void*) *bl );
+
+	if ( writeLibraryFn != 0 )
+		::free( (void*)writeLibraryFn );
+
+	if ( libraryOut != 0 )
+		delete libraryOut;
+
+	for ( ArgsVector::Iter ll = loadLibraryFns; ll.lte(); ll++ )
+		free( (void*) *ll );
+
+	for ( Vector<LibMachine*>::Iter lm = libMachines; lm.lte(); lm++ )
+		delete *lm;
+
+	for ( std::map<std::string, const char**>::iterator ic = includeChecks.begin();
+			ic != includeChecks.end(); ic++ )
+	{
+		for ( const char **check = ic->second; *check != 0; check++ )
+			delete[] *check;
+		delete[] ic->second;
+	}
+}
+
+/* Peak resident set size of the process, in kilobytes. */
+static long peakRss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) )
+		return 0;
+	return pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+#if defined(__APPLE__)
+	/* Reported in bytes. */
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
 }
 
 void InputData::makeDefaultFileName()
@@ -169,7 +313,7 @@ void InputData::prepareSingleMachine()
 	}
 
 	if ( machineName != 0 ) {
-		gdEl = pd->graphDict.find( machineName );
+		gdEl = pd->findGraph( machineName );
 		if ( gdEl == 0 )
 			error() << "machine definition/instantiation not found" << endp;
 	}
@@ -192,6 +336,7 @@ void InputData::prepareAllMachines()
 			pd->prepareMachineGen( 0, hostLang );
 
 			pd->makeExports();
+			writeLibExports( pd );
 		}
 
 	}
@@ -220,7 +365,878 @@ void InputData::verifyWritesHaveData()
 		verifyWriteHasData( ii );
 }
 
-void InputData::writeStatement( CodeGenData *cgd, InputLoc &loc, int nargs,
+/* Chunk size, in characters, for write exec_parallel. */
+#define EXEC_PARALLEL_CHUNK 1048576
+
+/* Characters run between merges of the runs of a chunk. */
+#define EXEC_PARALLEL_WINDOW 4096
+
+/* Run the exec loop over chunks of the buffer on OpenMP threads. The first
+ * chunk starts from cs. Every other chunk starts a run from every state, but
+ * runs that end a window in the same state go on as one, so once the runs
+ * converge a chunk costs about as much as a single run. The end states are
+ * then chained in order. Running a chunk from a state that is never reached
+ * would execute actions that should not happen, so only machines without
+ * actions are accepted. The scratch space of the runs is allocated once per
+ * thread. If any allocation fails, p and cs are left as they were. The exec
+ * block shadows p, pe, cs and eof, so the default variable names are
+ * required. C hosts only. */
+void InputData::writeExecParallel( ParseData *pd, CodeGenData *cgd, InputLoc &loc )
+{
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	if ( hostLang->defaultOutFn != &defaultOutFnC ) {
+		error(loc) << "write exec_parallel is only supported for C output" << endl;
+		return;
+	}
+	if ( fsmCtx->actionList.length() > 0 ) {
+		error(loc) << "write exec_parallel requires a machine without "
+				"actions" << endl;
+		return;
+	}
+	if ( fsmCtx->pExpr != 0 || fsmCtx->peExpr != 0 || fsmCtx->csExpr != 0 ||
+			fsmCtx->eofExpr != 0 || fsmCtx->accessExpr != 0 ||
+			fsmCtx->getKeyExpr != 0 )
+	{
+		error(loc) << "write exec_parallel cannot be used with variable, "
+				"access or getkey statements" << endl;
+		return;
+	}
+
+	std::string alph = pd->alphType->data1;
+	if ( pd->alphType->data2 != 0 )
+		alph = alph + " " + pd->alphType->data2;
+
+	long numStates = cgd->redFsm->stateList.length();
+
+	std::ostringstream head;
+	head <<
+		"	{\n"
+		"	const " << alph << " *_ep_base = p;\n"
+		"	long _ep_len = (long)( pe - p );\n"
+		"	long _ep_nchunks = ( _ep_len + " << EXEC_PARALLEL_CHUNK << " - 1 ) / " <<
+				EXEC_PARALLEL_CHUNK << ";\n"
+		"	int _ep_cs = cs;\n"
+		"	int _ep_fail = 0;\n"
+		"	int *_ep_ends;\n"
+		"	long _ep_c;\n"
+		"	if ( _ep_nchunks < 1 )\n"
+		"		_ep_nchunks = 1;\n"
+		"	_ep_ends = (int*) malloc( sizeof(int) * _ep_nchunks * " << numStates << " );\n"
+		"	if ( _ep_ends == 0 )\n"
+		"		_ep_fail = 1;\n"
+		"	else {\n"
+		"	#pragma omp parallel\n"
+		"	{\n"
+		"	int *_ep_run = (int*) malloc( sizeof(int) * 4 * " << numStates << " );\n"
+		"	int *_ep_from, *_ep_slot, *_ep_map;\n"
+		"	if ( _ep_run == 0 ) {\n"
+		"		#pragma omp critical\n"
+		"		_ep_fail = 1;\n"
+		"	}\n"
+		"	else {\n"
+		"		_ep_from = _ep_run + " << numStates << ";\n"
+		"		_ep_slot = _ep_from + " << numStates << ";\n"
+		"		_ep_map = _ep_slot + " << numStates << ";\n"
+		"	}\n"
+		"	#pragma omp for schedule(dynamic)\n"
+		"	for ( _ep_c = 0; _ep_c < _ep_nchunks; _ep_c++ ) {\n"
+		"	const " << alph << " *_ep_p = _ep_base + _ep_c * " << EXEC_PARALLEL_CHUNK << ";\n"
+		"	const " << alph << " *_ep_pe = _ep_c == _ep_nchunks - 1 ? _ep_base + _ep_len : _ep_p + " <<
+				EXEC_PARALLEL_CHUNK << ";\n"
+		"	int _ep_nruns, _ep_n, _ep_r, _ep_s;\n"
+		"	if ( _ep_run == 0 )\n"
+		"		continue;\n"
+		"	for ( _ep_s = 0; _ep_s < " << numStates << "; _ep_s++ ) {\n"
+		"		_ep_run[_ep_s] = _ep_c == 0 ? _ep_cs : _ep_s;\n"
+		"		_ep_from[_ep_s] = _ep_c == 0 ? 0 : _ep_s;\n"
+		"		_ep_slot[_ep_s] = -1;\n"
+		"	}\n"
+		"	_ep_nruns = _ep_c == 0 ? 1 : " << numStates << ";\n"
+		"	while ( _ep_p < _ep_pe ) {\n"
+		"	const " << alph << " *_ep_wpe = _ep_pe - _ep_p > " << EXEC_PARALLEL_WINDOW <<
+				" ? _ep_p + " << EXEC_PARALLEL_WINDOW << " : _ep_pe;\n"
+		"	for ( _ep_r = 0; _ep_r < _ep_nruns; _ep_r++ ) {\n"
+		"	const " << alph << " *p = _ep_p;\n"
+		"	const " << alph << " *pe = _ep_wpe;\n"
+		"	const " << alph << " *eof = 0;\n"
+		"	int cs = _ep_run[_ep_r];\n"
+		"	(void)eof;\n"
+		"	{\n";
+
+	std::ostringstream tail;
+	tail <<
+		"	}\n"
+		"	_ep_run[_ep_r] = cs;\n"
+		"	}\n"
+		"	_ep_p = _ep_wpe;\n"
+		"	_ep_n = 0;\n"
+		"	for ( _ep_r = 0; _ep_r < _ep_nruns; _ep_r++ ) {\n"
+		"		_ep_s = _ep_run[_ep_r];\n"
+		"		if ( _ep_slot[_ep_s] < 0 ) {\n"
+		"			_ep_slot[_ep_s] = _ep_n;\n"
+		"			_ep_run[_ep_n++] = _ep_s;\n"
+		"		}\n"
+		"		_ep_map[_ep_r] = _ep_slot[_ep_s];\n"
+		"	}\n"
+		"	for ( _ep_s = 0; _ep_s < " << numStates << "; _ep_s++ )\n"
+		"		_ep_from[_ep_s] = _ep_map[_ep_from[_ep_s]];\n"
+		"	for ( _ep_r = 0; _ep_r < _ep_n; _ep_r++ )\n"
+		"		_ep_slot[_ep_run[_ep_r]] = -1;\n"
+		"	_ep_nruns = _ep_n;\n"
+		"	}\n"
+		"	for ( _ep_s = 0; _ep_s < " << numStates << "; _ep_s++ )\n"
+		"		_ep_ends[_ep_c * " << numStates << " + _ep_s] = _ep_run[_ep_from[_ep_s]];\n"
+		"	}\n"
+		"	free( _ep_run );\n"
+		"	}\n"
+		"	}\n"
+		"	if ( !_ep_fail ) {\n"
+		"		cs = _ep_cs;\n"
+		"		for ( _ep_c = 0; _ep_c < _ep_nchunks; _ep_c++ )\n"
+		"			cs = _ep_ends[_ep_c * " << numStates << " + cs];\n"
+		"		p = pe;\n"
+		"	}\n"
+		"	free( _ep_ends );\n"
+		"	}\n";
+
+	writeHostCode( head.str(), loc );
+	cgd->writeExec();
+	writeHostCode( tail.str(), loc );
+}
+
+/* Dfa states held by write exec_lazy before the cache is flushed. */
+#define EXEC_LAZY_CACHE 1024
+
+/* Write a table for write exec_lazy. A zero is added at the end, so the table
+ * is never empty. */
+static void lazyTable( std::ostream &out, const char *type, const char *name,
+		const std::vector<unsigned long> &values )
+{
+	out << "	static const " << type << " " << name << "[] = {";
+	for ( size_t i = 0; i < values.size(); i++ ) {
+		if ( i % 16 == 0 )
+			out << "\n		";
+		out << values[i] << ", ";
+	}
+	out << "\n		0\n	};\n";
+}
+
+/* What a write of the code generator prints, such as a state id. */
+static std::string captureWrite( std::ostream *out, CodeGenData *cgd,
+		void (CodeGenData::*write)() )
+{
+	std::stringbuf text;
+	std::streambuf *prev = out->rdbuf( &text );
+	(cgd->*write)();
+	out->rdbuf( prev );
+	return text.str();
+}
+
+/* Run the machine as a dfa built lazily from the section's graph, which still
+ * has the nfa transitions of its |= unions. Each state's nfa transitions are
+ * folded into an epsilon closure here. The generated code caches dfa states,
+ * each a set of nfa states, and makes a state the first time a character
+ * leads out of one it has. A full cache is flushed. The input is accepted if
+ * any alternative accepts it, not only the one the backtracking of write exec
+ * settles on first. The run starts from the start state. cs is left as
+ * first_final if the input is accepted, as the error state with p on the
+ * failing character if every alternative failed, and otherwise as the start
+ * state, which must not be final. cs does not hold the set of nfa states, so
+ * a run can't be continued over another buffer. Several alternatives are live
+ * at once, so actions can't run and machines with actions are refused. If any
+ * allocation fails, p and cs are left as they were. C hosts with a single byte
+ * alphabet and the default variable names only. */
+void InputData::writeExecLazy( ParseData *pd, CodeGenData *cgd, InputLoc &loc )
+{
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	FsmAp *graph = pd->sectionGraph;
+	if ( hostLang->defaultOutFn != &defaultOutFnC ) {
+		error(loc) << "write exec_lazy is only supported for C output" << endl;
+		return;
+	}
+	if ( pd->alphType->size != 1 ) {
+		error(loc) << "write exec_lazy requires a single byte alphabet type" << endl;
+		return;
+	}
+	if ( fsmCtx->actionList.length() > 0 ) {
+		error(loc) << "write exec_lazy requires a machine without actions" << endl;
+		return;
+	}
+	if ( fsmCtx->pExpr != 0 || fsmCtx->peExpr != 0 || fsmCtx->csExpr != 0 ||
+			fsmCtx->eofExpr != 0 || fsmCtx->accessExpr != 0 ||
+			fsmCtx->getKeyExpr != 0 )
+	{
+		error(loc) << "write exec_lazy cannot be used with variable, "
+				"access or getkey statements" << endl;
+		return;
+	}
+	if ( graph->startState->isFinState() ) {
+		error(loc) << "write exec_lazy requires a start state that is "
+				"not final" << endl;
+		return;
+	}
+
+	/* Number the states in list order. */
+	std::map<StateAp*, long> stateIds;
+	std::vector<StateAp*> states;
+	for ( StateList::Iter st = graph->stateList; st.lte(); st++ ) {
+		stateIds[st] = states.size();
+		states.push_back( st );
+	}
+	long numStates = states.size();
+	long numWords = ( numStates + 31 ) / 32;
+
+	/* Transitions by state, as byte ranges. Without actions there are no
+	 * conditions, so every transition is plain. */
+	std::vector<unsigned long> transOffs, transLow, transHigh, transTo;
+	std::vector<unsigned long> final( numWords, 0 );
+	for ( long s = 0; s < numStates; s++ ) {
+		if ( states[s]->isFinState() )
+			final[s / 32] |= 1ul << ( s % 32 );
+
+		transOffs.push_back( transTo.size() );
+		for ( TransList::Iter trans = states[s]->outList; trans.lte(); trans++ ) {
+			StateAp *toState = trans->tdap()->toState;
+			if ( toState == 0 )
+				continue;
+
+			/* The keys of a signed alphabet are stored as the bytes they are
+			 * read from, which splits a range that crosses zero. */
+			long low = trans->lowKey.getVal();
+			long high = trans->highKey.getVal();
+			if ( low < 0 && high >= 0 ) {
+				transLow.push_back( low + 256 );
+				transHigh.push_back( 255 );
+				transTo.push_back( stateIds[toState] );
+				low = 0;
+			}
+			transLow.push_back( low & 0xff );
+			transHigh.push_back( high & 0xff );
+			transTo.push_back( stateIds[toState] );
+		}
+	}
+	transOffs.push_back( transTo.size() );
+
+	/* The epsilon closure of each state over its nfa transitions. */
+	std::vector<unsigned long> closeOffs, close;
+	std::vector<char> seen( numStates, 0 );
+	for ( long s = 0; s < numStates; s++ ) {
+		closeOffs.push_back( close.size() );
+		std::vector<StateAp*> stack( 1, states[s] );
+		while ( !stack.empty() ) {
+			StateAp *st = stack.back();
+			stack.pop_back();
+			long stateId = stateIds[st];
+			if ( seen[stateId] )
+				continue;
+
+			seen[stateId] = 1;
+			close.push_back( stateId );
+			if ( st->nfaOut != 0 ) {
+				for ( NfaTransList::Iter nt = *st->nfaOut; nt.lte(); nt++ )
+					stack.push_back( nt->toState );
+			}
+		}
+		for ( size_t c = closeOffs[s]; c < close.size(); c++ )
+			seen[close[c]] = 0;
+	}
+	closeOffs.push_back( close.size() );
+
+	if ( printStatistics )
+		stats() << "lazy-nfa-states\t" << numStates << endl;
+
+	long startId = stateIds[graph->startState];
+	std::string startCs = captureWrite( outStream, cgd, &CodeGenData::writeStart );
+	std::string finalCs = captureWrite( outStream, cgd, &CodeGenData::writeFirstFinal );
+	std::string errorCs = captureWrite( outStream, cgd, &CodeGenData::writeError );
+
+	std::ostringstream code;
+	code << "	{\n";
+	lazyTable( code, "int", "_lz_trans_offs", transOffs );
+	lazyTable( code, "unsigned char", "_lz_low", transLow );
+	lazyTable( code, "unsigned char", "_lz_high", transHigh );
+	lazyTable( code, "int", "_lz_to", transTo );
+	lazyTable( code, "int", "_lz_close_offs", closeOffs );
+	lazyTable( code, "int", "_lz_close", close );
+	lazyTable( code, "unsigned int", "_lz_final", final );
+	code <<
+		"	unsigned int *_lz_sets = (unsigned int*) malloc( sizeof(unsigned int) * " <<
+				EXEC_LAZY_CACHE * numWords << " );\n"
+		"	int *_lz_next = (int*) malloc( sizeof(int) * " << EXEC_LAZY_CACHE * 256 << " );\n"
+		"	int *_lz_chain = (int*) malloc( sizeof(int) * " << EXEC_LAZY_CACHE * 3 << " );\n"
+		"	char *_lz_acc = (char*) malloc( " << EXEC_LAZY_CACHE << " );\n"
+		"	unsigned int *_lz_cur = (unsigned int*) malloc( sizeof(unsigned int) * " <<
+				numWords << " );\n"
+		"	if ( _lz_sets != 0 && _lz_next != 0 && _lz_chain != 0 && _lz_acc != 0 && _lz_cur != 0 ) {\n"
+		"	int *_lz_bucket = _lz_chain + " << EXEC_LAZY_CACHE << ";\n"
+		"	const unsigned int *_lz_set;\n"
+		"	unsigned int _lz_h;\n"
+		"	int _lz_n = 0, _lz_d = -1, _lz_t = -1, _lz_c = 0, _lz_dead = 0;\n"
+		"	int _lz_i, _lz_s, _lz_k, _lz_j;\n"
+		"	for ( _lz_i = 0; _lz_i < " << EXEC_LAZY_CACHE * 2 << "; _lz_i++ )\n"
+		"		_lz_bucket[_lz_i] = -1;\n"
+		"	memset( _lz_cur, 0, sizeof(unsigned int) * " << numWords << " );\n"
+		"	for ( _lz_j = _lz_close_offs[" << startId << "]; _lz_j < _lz_close_offs[" <<
+				startId + 1 << "]; _lz_j++ )\n"
+		"		_lz_cur[_lz_close[_lz_j] >> 5] |= 1u << ( _lz_close[_lz_j] & 31 );\n"
+		"	while ( 1 ) {\n"
+		"		_lz_h = 2166136261u;\n"
+		"		for ( _lz_i = 0; _lz_i < " << numWords << "; _lz_i++ )\n"
+		"			_lz_h = ( _lz_h ^ _lz_cur[_lz_i] ) * 16777619u;\n"
+		"		_lz_h &= " << EXEC_LAZY_CACHE * 2 - 1 << ";\n"
+		"		_lz_t = _lz_bucket[_lz_h];\n"
+		"		while ( _lz_t >= 0 && memcmp( _lz_sets + (long)_lz_t * " << numWords <<
+				", _lz_cur, sizeof(unsigned int) * " << numWords << " ) != 0 )\n"
+		"			_lz_t = _lz_chain[_lz_t];\n"
+		"		if ( _lz_t < 0 ) {\n"
+		"			if ( _lz_n == " << EXEC_LAZY_CACHE << " ) {\n"
+		"				_lz_n = 0;\n"
+		"				_lz_d = -1;\n"
+		"				for ( _lz_i = 0; _lz_i < " << EXEC_LAZY_CACHE * 2 << "; _lz_i++ )\n"
+		"					_lz_bucket[_lz_i] = -1;\n"
+		"			}\n"
+		"			_lz_t = _lz_n++;\n"
+		"			memcpy( _lz_sets + (long)_lz_t * " << numWords <<
+				", _lz_cur, sizeof(unsigned int) * " << numWords << " );\n"
+		"			_lz_acc[_lz_t] = 0;\n"
+		"			for ( _lz_i = 0; _lz_i < " << numWords << "; _lz_i++ ) {\n"
+		"				if ( _lz_cur[_lz_i] & _lz_final[_lz_i] )\n"
+		"					_lz_acc[_lz_t] = 1;\n"
+		"			}\n"
+		"			for ( _lz_i = 0; _lz_i < 256; _lz_i++ )\n"
+		"				_lz_next[(long)_lz_t * 256 + _lz_i] = -1;\n"
+		"			_lz_chain[_lz_t] = _lz_bucket[_lz_h];\n"
+		"			_lz_bucket[_lz_h] = _lz_t;\n"
+		"		}\n"
+		"		if ( _lz_d >= 0 )\n"
+		"			_lz_next[(long)_lz_d * 256 + _lz_c] = _lz_t;\n"
+		"		_lz_d = _lz_t;\n"
+		"		while ( p < pe && ( _lz_t = _lz_next[(long)_lz_d * 256 + "
+				"(unsigned char)*p] ) >= 0 ) {\n"
+		"			_lz_d = _lz_t;\n"
+		"			p += 1;\n"
+		"		}\n"
+		"		if ( p == pe )\n"
+		"			break;\n"
+		"		_lz_c = (unsigned char)*p;\n"
+		"		if ( _lz_t == -2 ) {\n"
+		"			_lz_dead = 1;\n"
+		"			break;\n"
+		"		}\n"
+		"		_lz_set = _lz_sets + (long)_lz_d * " << numWords << ";\n"
+		"		memset( _lz_cur, 0, sizeof(unsigned int) * " << numWords << " );\n"
+		"		_lz_dead = 1;\n"
+		"		for ( _lz_s = 0; _lz_s < " << numStates << "; _lz_s++ ) {\n"
+		"			if ( !( _lz_set[_lz_s >> 5] & ( 1u << ( _lz_s & 31 ) ) ) )\n"
+		"				continue;\n"
+		"			for ( _lz_k = _lz_trans_offs[_lz_s]; _lz_k < _lz_trans_offs[_lz_s + 1]; _lz_k++ ) {\n"
+		"				if ( _lz_c < _lz_low[_lz_k] || _lz_c > _lz_high[_lz_k] )\n"
+		"					continue;\n"
+		"				_lz_dead = 0;\n"
+		"				for ( _lz_j = _lz_close_offs[_lz_to[_lz_k]]; "
+				"_lz_j < _lz_close_offs[_lz_to[_lz_k] + 1]; _lz_j++ )\n"
+		"					_lz_cur[_lz_close[_lz_j] >> 5] |= 1u << ( _lz_close[_lz_j] & 31 );\n"
+		"			}\n"
+		"		}\n"
+		"		if ( _lz_dead ) {\n"
+		"			_lz_next[(long)_lz_d * 256 + _lz_c] = -2;\n"
+		"			break;\n"
+		"		}\n"
+		"		p += 1;\n"
+		"	}\n"
+		"	if ( _lz_dead )\n"
+		"		cs = " << errorCs << ";\n"
+		"	else if ( _lz_acc[_lz_d] )\n"
+		"		cs = " << finalCs << ";\n"
+		"	else\n"
+		"		cs = " << startCs << ";\n"
+		"	}\n"
+		"	free( _lz_sets );\n"
+		"	free( _lz_next );\n"
+		"	free( _lz_chain );\n"
+		"	free( _lz_acc );\n"
+		"	free( _lz_cur );\n"
+		"	}\n";
+
+	writeHostCode( code.str(), loc );
+}
+
+/* Chunk of the buffer given to the exec block between prefilter skips. */
+#define PREFILTER_WINDOW 256
+
+/* A write exec that skips ahead with memchr whenever the machine is in the
+ * start state and that state can only be left on one key. The exec block is
+ * run over windows of the buffer so the skip is retried after a false match.
+ * Running a machine over consecutive windows is the same as running it over
+ * the whole buffer, so actions are unaffected. Returns false, having written
+ * nothing, if the machine or host does not qualify. */
+bool InputData::writeExecPrefilter( ParseData *pd, CodeGenData *cgd, InputLoc &loc )
+{
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	if ( hostLang->defaultOutFn != &defaultOutFnC )
+		return false;
+	if ( fsmCtx->pExpr != 0 || fsmCtx->peExpr != 0 || fsmCtx->csExpr != 0 ||
+			fsmCtx->accessExpr != 0 || fsmCtx->getKeyExpr != 0 )
+		return false;
+
+	/* With noend the exec block does not stop at pe, so there is no window
+	 * to run it over. */
+	if ( cgd->noEnd )
+		return false;
+
+	Key key;
+	if ( !pd->prefilterKey( key ) )
+		return false;
+
+	std::string alph = pd->alphType->data1;
+	if ( pd->alphType->data2 != 0 )
+		alph = alph + " " + pd->alphType->data2;
+
+	int startId = cgd->redFsm->startState->id;
+
+	if ( printStatistics )
+		stats() << "prefilter-key\t" << key.getVal() << endl;
+
+	/* The window is made by pulling pe back, so the exec block sees the
+	 * variables with the types they were declared with. _pf_rest is the part
+	 * of the buffer beyond the window. */
+	std::ostringstream head;
+	head <<
+		"	{\n"
+		"	long _pf_rest;\n"
+		"	while ( 1 ) {\n"
+		"	if ( cs == " << startId << " && p < pe ) {\n"
+		"		const " << alph << " *_pf_hit = (const " << alph << "*) memchr( p, " <<
+				( key.getVal() & 0xff ) << ", pe - p );\n"
+		"		p = _pf_hit != 0 ? p + ( _pf_hit - p ) : p + ( pe - p );\n"
+		"	}\n"
+		"	_pf_rest = pe - p > " << PREFILTER_WINDOW << " ? (long)( pe - p ) - " <<
+				PREFILTER_WINDOW << " : 0;\n"
+		"	pe -= _pf_rest;\n"
+		"	{\n";
+
+	std::ostringstream tail;
+	tail <<
+		"	}\n"
+		"	pe += _pf_rest;\n"
+		"	if ( p != pe - _pf_rest || _pf_rest == 0 )\n"
+		"		break;\n"
+		"	}\n"
+		"	}\n";
+
+	writeHostCode( head.str(), loc );
+	cgd->writeExec();
+	writeHostCode( tail.str(), loc );
+	return true;
+}
+
+/* A buffer manager for scanners, from write buffer. The buffer is a ring
+ * mapped twice in a row, so data that runs off the end of the first mapping
+ * continues in the second. A token in progress is never moved to make room for
+ * more input. Once everything kept has passed into the second mapping the
+ * pointers are moved back by the size of the ring, which leaves the data they
+ * see unchanged. The functions take the scanner's pointers, so they work with
+ * any variable names. C hosts with a single byte alphabet only. */
+void InputData::writeBuffer( ParseData *pd, CodeGenData *cgd, InputLoc &loc )
+{
+	if ( hostLang->defaultOutFn != &defaultOutFnC ) {
+		error(loc) << "write buffer is only supported for C output" << endl;
+		return;
+	}
+	if ( pd->alphType->size != 1 ) {
+		error(loc) << "write buffer requires a single byte alphabet type" << endl;
+		return;
+	}
+
+	std::string alph = pd->alphType->data1;
+	if ( pd->alphType->data2 != 0 )
+		alph = alph + " " + pd->alphType->data2;
+
+	std::string buf = cgd->fsmName + "_buffer";
+
+	std::ostringstream code;
+	code <<
+		"struct " << buf << "\n"
+		"{\n"
+		"	" << alph << " *data;\n"
+		"	long size;\n"
+		"};\n"
+		"\n"
+		"static int " << buf << "_open( struct " << buf << " *b, long size )\n"
+		"{\n"
+		"	char path[] = \"/tmp/ragel-buffer-XXXXXX\";\n"
+		"	long page = sysconf( _SC_PAGESIZE );\n"
+		"	char *addr;\n"
+		"	int fd;\n"
+		"	size = ( size + page - 1 ) / page * page;\n"
+		"	fd = mkstemp( path );\n"
+		"	if ( fd < 0 )\n"
+		"		return -1;\n"
+		"	unlink( path );\n"
+		"	if ( ftruncate( fd, size ) != 0 ) {\n"
+		"		close( fd );\n"
+		"		return -1;\n"
+		"	}\n"
+		"	addr = (char*) mmap( 0, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );\n"
+		"	if ( addr == MAP_FAILED ) {\n"
+		"		close( fd );\n"
+		"		return -1;\n"
+		"	}\n"
+		"	if ( mmap( addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ||\n"
+		"			mmap( addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED )\n"
+		"	{\n"
+		"		munmap( addr, 2 * size );\n"
+		"		close( fd );\n"
+		"		return -1;\n"
+		"	}\n"
+		"	close( fd );\n"
+		"	b->data = (" << alph << "*) addr;\n"
+		"	b->size = size;\n"
+		"	return 0;\n"
+		"}\n"
+		"\n"
+		"static void " << buf << "_close( struct " << buf << " *b )\n"
+		"{\n"
+		"	munmap( (char*) b->data, 2 * b->size );\n"
+		"}\n"
+		"\n"
+		"static long " << buf << "_space( struct " << buf << " *b, " <<
+				alph << " **p, " << alph << " **pe, " << alph << " **ts, " << alph << " **te )\n"
+		"{\n"
+		"	" << alph << " *keep = *ts != 0 ? *ts : *p;\n"
+		"	if ( keep >= b->data + b->size ) {\n"
+		"		*p -= b->size;\n"
+		"		*pe -= b->size;\n"
+		"		if ( *ts != 0 )\n"
+		"			*ts -= b->size;\n"
+		"		if ( *te >= b->data + b->size )\n"
+		"			*te -= b->size;\n"
+		"		keep -= b->size;\n"
+		"	}\n"
+		"	return b->size - ( *pe - keep );\n"
+		"}\n"
+		"\n"
+		"static long " << buf << "_read( struct " << buf << " *b, int fd, " <<
+				alph << " **p, " << alph << " **pe, " << alph << " **ts, " << alph << " **te )\n"
+		"{\n"
+		"	long space = " << buf << "_space( b, p, pe, ts, te );\n"
+		"	long len;\n"
+		"	if ( space == 0 ) {\n"
+		"		errno = ENOBUFS;\n"
+		"		return -1;\n"
+		"	}\n"
+		"	len = read( fd, *pe, space );\n"
+		"	if ( len > 0 )\n"
+		"		*pe += len;\n"
+		"	return len;\n"
+		"}\n";
+
+	writeHostCode( code.str(), loc );
+}
+
+/* Bytes used in a snapshot for values from zero to max. */
+static int snapshotBytes( long max )
+{
+	return max < 0x100 ? 1 : ( max < 0x10000 ? 2 : 4 );
+}
+
+/* Store a value in a snapshot, low byte first. */
+static void snapshotPut( std::ostream &out, const char *indent,
+		const std::string &value, int bytes )
+{
+	for ( int i = 0; i < bytes; i++ ) {
+		out << indent << "_sv[" << i << "] = (unsigned char)";
+		if ( i == 0 )
+			out << "( " << value << " );\n";
+		else
+			out << "( ( " << value << " ) >> " << ( i * 8 ) << " );\n";
+	}
+	out << indent << "_sv += " << bytes << ";\n";
+}
+
+static void snapshotGet( std::ostream &out, const char *indent,
+		const std::string &dest, int bytes )
+{
+	out << indent << dest << " = _sv[0]";
+	for ( int i = 1; i < bytes; i++ )
+		out << " | (unsigned long)_sv[" << i << "] << " << ( i * 8 );
+	out << ";\n";
+	out << indent << "_sv += " << bytes << ";\n";
+}
+
+/* Snapshots for suspend and resume, from write state_size, write save and
+ * write restore. The layout holds only what the machine uses, packed into
+ * bytes: cs, then top and the stack if there are calls, act if the scanner
+ * needs it, where p and te sit in the pending token for scanners, and last the
+ * input from the token start (or p) to pe. Values, and input characters wider
+ * than a byte, are stored low byte first, so a snapshot can move between
+ * threads and machines of either byte order. The nfa backtracking stack is
+ * not stored, so machines with nfa states are refused. The default variable
+ * names are required. C hosts only. */
+bool InputData::checkSnapshot( ParseData *pd, InputLoc &loc, const char *what )
+{
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	if ( hostLang->defaultOutFn != &defaultOutFnC ) {
+		error(loc) << "write " << what << " is only supported for C output" << endl;
+		return false;
+	}
+	if ( fsmCtx->pExpr != 0 || fsmCtx->peExpr != 0 || fsmCtx->csExpr != 0 ||
+			fsmCtx->topExpr != 0 || fsmCtx->stackExpr != 0 ||
+			fsmCtx->actExpr != 0 || fsmCtx->tokstartExpr != 0 ||
+			fsmCtx->tokendExpr != 0 )
+	{
+		error(loc) << "write " << what << " cannot be used with variable "
+				"statements" << endl;
+		return false;
+	}
+	if ( pd->nfaStates() ) {
+		error(loc) << "write " << what << " cannot be used with nfa states" << endl;
+		return false;
+	}
+	return true;
+}
+
+/* Fixed part of the snapshot. The stack and the pending input come on top. */
+static long snapshotFixed( const SnapshotLayout &layout, int csBytes )
+{
+	long fixed = csBytes + 4;
+	if ( layout.stack )
+		fixed += 4;
+	if ( layout.act )
+		fixed += snapshotBytes( layout.maxActId );
+	if ( layout.tokens )
+		fixed += 9;
+	return fixed;
+}
+
+void InputData::writeStateSize( ParseData *pd, CodeGenData *cgd, InputLoc &loc )
+{
+	if ( !checkSnapshot( pd, loc, "state_size" ) )
+		return;
+
+	SnapshotLayout layout;
+	pd->snapshotLayout( layout );
+	int csBytes = snapshotBytes( cgd->redFsm->stateList.length() );
+
+	std::ostringstream code;
+	code << "( " << snapshotFixed( layout, csBytes );
+	if ( layout.stack )
+		code << " + top * " << csBytes;
+	code << " + ( pe - " << ( layout.tokens ? "( ts != 0 ? ts : p )" : "p" ) <<
+			" ) * " << pd->alphType->size << " )";
+
+	writeHostCode( code.str(), loc );
+}
+
+void InputData::writeSave( ParseData *pd, CodeGenData *cgd, InputLoc &loc,
+		int nargs, std::vector<std::string> &args )
+{
+	if ( nargs != 2 ) {
+		error(loc) << "write save takes the snapshot to write to" << endl;
+		return;
+	}
+	if ( !checkSnapshot( pd, loc, "save" ) )
+		return;
+
+	SnapshotLayout layout;
+	pd->snapshotLayout( layout );
+	int csBytes = snapshotBytes( cgd->redFsm->stateList.length() );
+
+	std::string alph = pd->alphType->data1;
+	if ( pd->alphType->data2 != 0 )
+		alph = alph + " " + pd->alphType->data2;
+
+	std::ostringstream code;
+	code <<
+		"	{\n"
+		"	unsigned char *_sv = (unsigned char*) ( " << args[1] << " );\n"
+		"	const " << alph << " *_sv_keep = " <<
+				( layout.tokens ? "ts != 0 ? ts : p" : "p" ) << ";\n"
+		"	long _sv_len = (long)( pe - _sv_keep );\n";
+	if ( layout.stack || pd->alphType->size > 1 )
+		code << "	long _sv_i;\n";
+
+	snapshotPut( code, "	", "cs", csBytes );
+	if ( layout.stack ) {
+		snapshotPut( code, "	", "top", 4 );
+		code << "	for ( _sv_i = 0; _sv_i < top; _sv_i++ ) {\n";
+		snapshotPut( code, "		", "stack[_sv_i]", csBytes );
+		code << "	}\n";
+	}
+	if ( layout.act )
+		snapshotPut( code, "	", "act", snapshotBytes( layout.maxActId ) );
+	if ( layout.tokens ) {
+		snapshotPut( code, "	", "ts != 0", 1 );
+		snapshotPut( code, "	", "p - _sv_keep", 4 );
+		snapshotPut( code, "	", "ts != 0 && te > ts ? te - ts : 0", 4 );
+	}
+	snapshotPut( code, "	", "_sv_len", 4 );
+	if ( pd->alphType->size > 1 ) {
+		code << "	for ( _sv_i = 0; _sv_i < _sv_len; _sv_i++ ) {\n";
+		snapshotPut( code, "		", "(unsigned long)_sv_keep[_sv_i]", pd->alphType->size );
+		code << "	}\n";
+	}
+	else {
+		code << "	memcpy( _sv, _sv_keep, _sv_len );\n";
+	}
+	code << "	}\n";
+
+	writeHostCode( code.str(), loc );
+}
+
+/* Restoring puts the pending input at p, which must have room for it. */
+void InputData::writeRestore( ParseData *pd, CodeGenData *cgd, InputLoc &loc,
+		int nargs, std::vector<std::string> &args )
+{
+	if ( nargs != 2 ) {
+		error(loc) << "write restore takes the snapshot to read from" << endl;
+		return;
+	}
+	if ( !checkSnapshot( pd, loc, "restore" ) )
+		return;
+
+	SnapshotLayout layout;
+	pd->snapshotLayout( layout );
+	int csBytes = snapshotBytes( cgd->redFsm->stateList.length() );
+
+	std::string alph = pd->alphType->data1;
+	if ( pd->alphType->data2 != 0 )
+		alph = alph + " " + pd->alphType->data2;
+
+	std::ostringstream code;
+	code <<
+		"	{\n"
+		"	const unsigned char *_sv = (const unsigned char*) ( " << args[1] << " );\n"
+		"	long _sv_len;\n";
+	if ( layout.stack || pd->alphType->size > 1 )
+		code << "	long _sv_i;\n";
+	if ( layout.tokens )
+		code << "	long _sv_tok, _sv_p, _sv_te;\n";
+
+	snapshotGet( code, "	", "cs", csBytes );
+	if ( layout.stack ) {
+		snapshotGet( code, "	", "top", 4 );
+		code << "	for ( _sv_i = 0; _sv_i < top; _sv_i++ ) {\n";
+		snapshotGet( code, "		", "stack[_sv_i]", csBytes );
+		code << "	}\n";
+	}
+	if ( layout.act )
+		snapshotGet( code, "	", "act", snapshotBytes( layout.maxActId ) );
+	if ( layout.tokens ) {
+		snapshotGet( code, "	", "_sv_tok", 1 );
+		snapshotGet( code, "	", "_sv_p", 4 );
+		snapshotGet( code, "	", "_sv_te", 4 );
+	}
+	snapshotGet( code, "	", "_sv_len", 4 );
+	if ( pd->alphType->size > 1 ) {
+		code << "	for ( _sv_i = 0; _sv_i < _sv_len; _sv_i++ ) {\n";
+		snapshotGet( code, "		", "( (" + alph + "*) p )[_sv_i]", pd->alphType->size );
+		code << "	}\n";
+	}
+	else {
+		code << "	memcpy( (void*) p, _sv, _sv_len );\n";
+	}
+	code << "	pe = p + _sv_len;\n";
+	if ( layout.tokens ) {
+		code <<
+			"	if ( _sv_tok ) {\n"
+			"		ts = p;\n"
+			"		te = p + _sv_te;\n"
+			"	}\n"
+			"	else {\n"
+			"		ts = 0;\n"
+			"	}\n"
+			"	p += _sv_p;\n";
+	}
+	code << "	}\n";
+
+	writeHostCode( code.str(), loc );
+}
+
+/* Host code around generated code. The translating backends take it in a host
+ * block. */
+void InputData::writeHostCode( const std::string &code, const InputLoc &loc )
+{
+	if ( hostLang->backend == Translated ) {
+		openHostBlock( '@', this, *outStream, inputFileName, loc.line );
+		*outStream << code << "}@";
+	}
+	else {
+		*outStream << code;
+	}
+}
+
+/* Write data, replacing any array already written by an earlier write data
+ * with a define naming the first. The arrays are recognized in the generated
+ * text, which is held back until the data is complete. */
+void InputData::writeSharedData( CodeGenData *cgd )
+{
+	std::stringbuf data;
+	std::streambuf *prev = outStream->rdbuf( &data );
+	cgd->writeData();
+	outStream->rdbuf( prev );
+
+	std::string text = data.str();
+	std::string::size_type pos = 0;
+	long shared = 0;
+	while ( true ) {
+		std::string::size_type def = text.find( "static const ", pos );
+		if ( def == std::string::npos )
+			break;
+
+		/* Only definitions that start a line. */
+		if ( def > 0 && text[def-1] != '\n' ) {
+			pos = def + 1;
+			continue;
+		}
+
+		std::string::size_type eol = text.find( '\n', def );
+		std::string::size_type open = text.find( '{', def );
+		std::string::size_type br = text.find( '[', def );
+		std::string::size_type end = text.find( "};", def );
+		if ( open == std::string::npos || br == std::string::npos ||
+				end == std::string::npos || br > open || open > eol )
+		{
+			pos = def + 1;
+			continue;
+		}
+
+		/* Name is the last word before the brackets. */
+		std::string::size_type nameEnd = br;
+		while ( nameEnd > def && text[nameEnd-1] == ' ' )
+			nameEnd -= 1;
+		std::string::size_type nameStart = nameEnd;
+		while ( nameStart > def && ( isalnum( text[nameStart-1] ) || text[nameStart-1] == '_' ) )
+			nameStart -= 1;
+		std::string name = text.substr( nameStart, nameEnd - nameStart );
+
+		/* Key on the type and the contents, ignoring layout. */
+		std::string key = text.substr( def, nameStart - def ) + "\n";
+		for ( std::string::size_type i = open; i < end; i++ ) {
+			if ( !isspace( text[i] ) )
+				key += text[i];
+		}
+
+		std::map<std::string, std::string>::iterator first = sharedTables.find( key );
+		if ( first == sharedTables.end() ) {
+			sharedTables[key] = name;
+			pos = end + 2;
+		}
+		else {
+			std::string define = "#define " + name + " " + first->second;
+			text.replace( def, end + 2 - def, define );
+			pos = def + define.size();
+			shared += 1;
+		}
+	}
+
+	if ( printStatistics )
+		stats() << "shared-tables\t" << shared << endl;
+
+	*outStream << text;
+}
+
+void InputData::writeStatement( ParseData *pd, CodeGenData *cgd, InputLoc &loc, int nargs,
 		std::vector<std::string> &args, bool generateDot, const HostLang *hostLang )
 {
 	/* Start write generation on a fresh line. */
@@ -251,7 +1267,11 @@ void InputData::writeStatement( CodeGenData *cgd, InputLoc &loc, int nargs,
 		}
 
 		cgd->collectReferences();
-		cgd->writeData();
+		if ( shareTables && hostLang->backend == Direct &&
+				hostLang->defaultOutFn == &defaultOutFnC )
+			writeSharedData( cgd );
+		else
+			cgd->writeData();
 		cgd->statsSummary();
 	}
 	else if ( args[0] == "init" ) {
@@ -271,7 +1291,35 @@ void InputData::writeStatement( CodeGenData *cgd, InputLoc &loc, int nargs,
 				cgd->write_option_error( loc, args[i] );
 		}
 		cgd->collectReferences();
-		cgd->writeExec();
+		if ( !prefilter || !writeExecPrefilter( pd, cgd, loc ) )
+			cgd->writeExec();
+	}
+	else if ( args[0] == "exec_parallel" ) {
+		for ( int i = 1; i < nargs; i++ )
+			cgd->write_option_error( loc, args[i] );
+		cgd->collectReferences();
+		writeExecParallel( pd, cgd, loc );
+	}
+	else if ( args[0] == "exec_lazy" ) {
+		for ( int i = 1; i < nargs; i++ )
+			cgd->write_option_error( loc, args[i] );
+		writeExecLazy( pd, cgd, loc );
+	}
+	else if ( args[0] == "state_size" ) {
+		for ( int i = 1; i < nargs; i++ )
+			cgd->write_option_error( loc, args[i] );
+		writeStateSize( pd, cgd, loc );
+	}
+	else if ( args[0] == "save" ) {
+		writeSave( pd, cgd, loc, nargs, args );
+	}
+	else if ( args[0] == "restore" ) {
+		writeRestore( pd, cgd, loc, nargs, args );
+	}
+	else if ( args[0] == "buffer" ) {
+		for ( int i = 1; i < nargs; i++ )
+			cgd->write_option_error( loc, args[i] );
+		writeBuffer( pd, cgd, loc );
 	}
 	else if ( args[0] == "exports" ) {
 		for ( int i = 1; i < nargs; i++ )
@@ -305,33 +1353,48 @@ void InputData::writeStatement( CodeGenData *cgd, InputLoc &loc, int nargs,
 	}
 }
 
-void InputData::writeOutput( InputItem *ii )
+/* Output that goes ahead of an input item: the byte order mark before the
+ * first item and the line directive before direct host data. */
+void InputData::writeItemHead( InputItem *ii )
 {
 	/* If it is the first input item then check if we need to write the BOM. */
 	if ( ii->prev == 0 && utf8BomPresent )
 		*outStream << (uchar)0xEF << (uchar)0xBB << (uchar) 0xBF;
 
+	if ( ii->type == InputItem::HostData && hostLang->backend == Direct &&
+			ii->loc.fileName != 0 )
+	{
+		if ( ii->prev != 0 )
+			*outStream << "\n";
+		(*hostLang->genLineDirective)( *outStream, !noLineDirectives, ii->loc.line, ii->loc.fileName );
+	}
+}
+
+void InputData::writeOutput( InputItem *ii )
+{
+	/* Went out as it was parsed. */
+	if ( ii->streamed )
+		return;
+
+	writeItemHead( ii );
+
 	switch ( ii->type ) {
 		case InputItem::Write: {
 			CodeGenData *cgd = ii->pd->cgd;
-			writeStatement( cgd, ii->loc, ii->writeArgs.size(),
+			writeStatement( ii->pd, cgd, ii->loc, ii->writeArgs.size(),
 					ii->writeArgs, generateDot, hostLang );
 			break;
 		}
 		case InputItem::HostData: {
 			switch ( hostLang->backend ) {
 				case Direct:
-					if ( ii->loc.fileName != 0 ) {
-						if ( ii->prev != 0 )
-							*outStream << "\n";
-						(*hostLang->genLineDirective)( *outStream, !noLineDirectives, ii->loc.line, ii->loc.fileName );
-					}
-						
+					if ( ii->dataLength > 0 )
+						outStream->write( inputMap + ii->dataStart, ii->dataLength );
 					*outStream << ii->data.str();
 					break;
 				case Translated:
 					openHostBlock( '@', this, *outStream, inputFileName, ii->loc.line );
-					translatedHostData( *outStream, ii->data.str() );
+					translatedHostData( *outStream, hostData( ii ) );
 					*outStream << "}@";
 					break;
 			}
@@ -343,6 +1406,93 @@ void InputData::writeOutput( InputItem *ii )
 	}
 }
 
+/* Add host data to an input item. When everything ahead of the item has been
+ * flushed the data goes straight out. Otherwise it is recorded as a range of
+ * the mapped input, or copied if it cannot be found there. The offset of the
+ * data in the input is -1 if not known. */
+void InputData::appendHostData( InputItem *ii, const char *data, long length, long offset )
+{
+	if ( !ii->streamed && ii == lastFlush && outStream != 0 &&
+			outputFileName != 0 && hostLang->backend == Direct &&
+			ii->dataLength == 0 && ii->data.tellp() <= 0 )
+	{
+		/* Any failure later on removes the output file. */
+		writeItemHead( ii );
+		ii->streamed = true;
+	}
+
+	if ( ii->streamed ) {
+		outStream->write( data, length );
+		return;
+	}
+
+	if ( offset >= 0 && offset + length <= inputMapLength &&
+			ii->data.tellp() <= 0 &&
+			( ii->dataLength == 0 || ii->dataStart + ii->dataLength == offset ) &&
+			memcmp( inputMap + offset, data, length ) == 0 )
+	{
+		if ( ii->dataLength == 0 )
+			ii->dataStart = offset;
+		ii->dataLength += length;
+		return;
+	}
+
+	/* Copy, bringing along any range recorded so far. */
+	if ( ii->dataLength > 0 ) {
+		ii->data.write( inputMap + ii->dataStart, ii->dataLength );
+		ii->dataLength = 0;
+	}
+	ii->data.write( data, length );
+}
+
+std::string InputData::hostData( InputItem *ii )
+{
+	if ( ii->dataLength > 0 )
+		return std::string( inputMap + ii->dataStart, ii->dataLength );
+	return ii->data.str();
+}
+
+/* Map the root input file so host data can refer to it rather than holding a
+ * copy. Without a map all host data is copied. */
+void InputData::mapInput()
+{
+	if ( input != 0 ) {
+		inputMap = input;
+		inputMapLength = strlen( input );
+		return;
+	}
+
+#ifndef _WIN32
+	int fd = open( inputFileName, O_RDONLY );
+	if ( fd < 0 )
+		return;
+
+	struct stat st;
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+		void *map = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( map != MAP_FAILED ) {
+			inputMap = (const char*)map;
+			inputMapLength = st.st_size;
+			inputMapOwned = true;
+		}
+	}
+
+	close( fd );
+#endif
+}
+
+void InputData::unmapInput()
+{
+#ifndef _WIN32
+	if ( inputMapOwned )
+		munmap( (void*)inputMap, inputMapLength );
+#endif
+
+	inputMap = 0;
+	inputMapLength = 0;
+	inputMapOwned = false;
+}
+
 void InputData::closeOutput()
 {
 	/* If writing to a file, delete the ostream, causing it to flush.
@@ -405,23 +1555,41 @@ bool InputData::checkLastRef( InputItem *ii )
 				ii->parser->terminateParser();
 #endif
 
-			FsmRes res = pd->prepareMachineGen( 0, hostLang );
-
-			/* Compute exports from the export definitions. */
-			pd->makeExports();
-
-			if ( !res.success() )
-				return false;
+			if ( codegenJobs > 1 ) {
+				/* Sections are generated on the pool in batches of one per
+				 * worker, so only a batch is held in memory at a time. */
+				bool pending = false;
+				for ( Vector<ParseData*>::Iter ps = pendingSections; ps.lte(); ps++ )
+					pending = pending || *ps == pd;
+				if ( !pending )
+					pendingSections.append( pd );
 
-			if ( errorCount > 0 )
-				return false;
+				if ( pendingSections.length() < codegenJobs )
+					return true;
 
-			pd->generateReduced( inputFileName, codeStyle, *outStream, hostLang );
+				if ( !generatePending() )
+					return false;
+			}
+			else {
+				bool success = generateSection( pd );
+				writeLibExports( pd );
+				if ( !success )
+					return false;
+			}
+		}
+		else if ( libraryOut != 0 ) {
+			/* No instances, but there may be exports for the library. */
+			pd->prepareLibrary( hostLang );
+			writeLibExports( pd );
 
 			if ( errorCount > 0 )
 				return false;
 		}
 
+		/* Nothing can be flushed past a section waiting for its batch. */
+		if ( pendingSections.length() > 0 )
+			return true;
+
 		/* Mark all input items referencing the machine as processed. */
 		InputItem *toMark = lastFlush;
 		while ( true ) {
@@ -433,21 +1601,179 @@ bool InputData::checkLastRef( InputItem *ii )
 			toMark = toMark->next;
 		}
 
-		/* Move forward, flushing input items until we get to an unprocessed
-		 * input item. */
-		while ( lastFlush != 0 && lastFlush->processed ) {
-			verifyWriteHasData( lastFlush );
+		/* Move forward, flushing input items until we get to an unprocessed
+		 * input item. */
+		while ( lastFlush != 0 && lastFlush->processed ) {
+			verifyWriteHasData( lastFlush );
+
+			if ( errorCount > 0 )
+				return false;
+
+			/* Flush out. */
+			writeOutput( lastFlush );
+			releaseSection( lastFlush );
+
+			lastFlush = lastFlush->next;
+		}
+	}
+	return true;
+}
+
+/* Build, minimize and analyze the machines of a section. On a codegen worker
+ * the reports are held by the section, so this can run on any thread. Only
+ * the section's own errors stop it. */
+bool InputData::prepareSection( ParseData *pd )
+{
+	FsmRes res = pd->prepareMachineGen( 0, hostLang );
+
+	/* Compute exports from the export definitions. */
+	pd->makeExports();
+
+	if ( !res.success() )
+		return false;
+
+	return pd->sectionErrors == 0;
+}
+
+/* Reduce the machine and make the code generator. The reducer and code
+ * generators report straight to the input data, so this stays on the main
+ * thread. */
+bool InputData::reduceSection( ParseData *pd )
+{
+	pd->generateReduced( inputFileName, codeStyle, *outStream, hostLang );
+
+	return pd->sectionErrors == 0 && errorCount == 0;
+}
+
+bool InputData::generateSection( ParseData *pd )
+{
+	return prepareSection( pd ) && reduceSection( pd );
+}
+
+struct SectionWorker
+{
+	InputData *id;
+	ParseData **sections;
+	bool *results;
+	long numSections;
+	long *nextSection;
+#ifndef _WIN32
+	pthread_mutex_t *mutex;
+#endif
+};
+
+static void *sectionWork( void *arg )
+{
+	SectionWorker *worker = (SectionWorker*)arg;
+	while ( true ) {
+#ifndef _WIN32
+		pthread_mutex_lock( worker->mutex );
+#endif
+		long s = (*worker->nextSection)++;
+#ifndef _WIN32
+		pthread_mutex_unlock( worker->mutex );
+#endif
+		if ( s >= worker->numSections )
+			break;
+
+		worker->results[s] = worker->id->prepareSection( worker->sections[s] );
+	}
+	return 0;
+}
+
+/* Generate the sections held back by checkLastRef. The machines are built on
+ * a pool of threads, then reduced here in input order, and the write
+ * statements are rendered afterwards, since line directives depend on the
+ * position in the output. */
+bool InputData::generatePending()
+{
+	long numSections = pendingSections.length();
+	long numWorkers = codegenJobs;
+#ifdef _WIN32
+	numWorkers = 1;
+#endif
+	if ( numWorkers > numSections )
+		numWorkers = numSections;
+	if ( numWorkers < 1 )
+		numWorkers = 1;
+
+	bool *results = new bool[numSections];
+	long nextSection = 0;
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+	pthread_mutex_init( &mutex, 0 );
+#endif
+
+	for ( long s = 0; s < numSections; s++ )
+		pendingSections[s]->holdReports = true;
+
+	SectionWorker *workers = new SectionWorker[numWorkers];
+	for ( long w = 0; w < numWorkers; w++ ) {
+		workers[w].id = this;
+		workers[w].sections = pendingSections.data;
+		workers[w].results = results;
+		workers[w].numSections = numSections;
+		workers[w].nextSection = &nextSection;
+#ifndef _WIN32
+		workers[w].mutex = &mutex;
+#endif
+	}
+
+#ifndef _WIN32
+	pthread_t *threads = new pthread_t[numWorkers];
+	long started = 1;
+	for ( ; started < numWorkers; started++ ) {
+		if ( pthread_create( &threads[started], 0, sectionWork, &workers[started] ) != 0 )
+			break;
+	}
+	sectionWork( &workers[0] );
+	for ( long w = 1; w < started; w++ )
+		pthread_join( threads[w], 0 );
+	delete[] threads;
+	pthread_mutex_destroy( &mutex );
+#else
+	sectionWork( &workers[0] );
+#endif
+
+	/* Report in input order, as the serial generation would have. */
+	for ( long s = 0; s < numSections; s++ ) {
+		pendingSections[s]->holdReports = false;
+		pendingSections[s]->flushReports();
+		if ( results[s] && errorCount == 0 )
+			results[s] = reduceSection( pendingSections[s] );
+	}
+
+	if ( printStatistics ) {
+		stats() << "codegen sections\t" << numSections << endl;
+		stats() << "codegen workers\t" << numWorkers << endl;
+	}
+
+	bool success = true;
+	for ( long s = 0; s < numSections; s++ ) {
+		writeLibExports( pendingSections[s] );
+		success = success && results[s];
+	}
+
+	delete[] workers;
+	delete[] results;
+	pendingSections.empty();
 
-			if ( errorCount > 0 )
-				return false;
+	return success && errorCount == 0;
+}
 
-			/* Flush out. */
-			writeOutput( lastFlush );
+/* Once the last reference to a section is written out, nothing needs its
+ * graph, reduced machine or parse tree any longer. */
+void InputData::releaseSection( InputItem *ii )
+{
+	if ( ii->section == 0 || ii->section->lastReference != ii || ii->pd == 0 )
+		return;
 
-			lastFlush = lastFlush->next;
-		}
+	ii->pd->clear();
+
+	if ( printStatistics ) {
+		stats() << "released\t" << ii->pd->sectionName << endl;
+		stats() << "peak-rss-kb\t" << peakRss() << endl;
 	}
-	return true;
 }
 
 void InputData::makeFirstInputItem()
@@ -479,13 +1805,28 @@ void InputData::flushRemaining()
 		item = item->next;
 	}
 
+	if ( pendingSections.length() > 0 ) {
+		if ( !generatePending() )
+			return;
+
+		for ( item = lastFlush; item != 0; item = item->next ) {
+			verifyWriteHasData( item );
+			if ( errorCount > 0 )
+				return;
+		}
+	}
+
 	/* Flush remaining items. */
 	while ( lastFlush != 0 ) {
 		/* Flush out. */
 		writeOutput( lastFlush );
+		releaseSection( lastFlush );
 
 		lastFlush = lastFlush->next;
 	}
+
+	if ( printStatistics )
+		stats() << "peak-rss-kb\t" << peakRss() << endl;
 }
 
 void InputData::makeTranslateOutputFileName()
@@ -585,11 +1926,11 @@ bool InputData::parseReduce()
 		return false;
 
 	makeFirstInputItem();
+	mapInput();
 	
 	curItem = inputItems.head;
 	lastFlush = inputItems.head;
 
-
 	topLevel->reduceFile( "rlparse", inputFileName );
 
 	if ( errorCount )
@@ -627,6 +1968,11 @@ bool InputData::processReduce()
 
 bool InputData::process()
 {
+	/* Opened here rather than with the arguments since the frontend may run
+	 * in a child process. */
+	if ( writeLibraryFn != 0 && libraryOut == 0 )
+		openLibrary();
+
 	switch ( frontend ) {
 		case KelbtBased: {
 #ifdef WITH_RAGEL_KELBT
@@ -657,6 +2003,18 @@ void InputData::usage()
 "   --rlhc               Show the rlhc command used to compile\n"
 "   --save-temps         Do not delete intermediate file during compilation\n"
 "   --no-intermediate    Disable call to rlhc, leave behind intermediate\n"
+"   --codegen-jobs=N     Generate machine specifications on N threads, 0\n"
+"                        for one per processor. Output is written once\n"
+"                        all are generated\n"
+"   --rlhc-jobs=N        Translate the intermediate file in pieces, N at\n"
+"                        a time, 0 for one per processor\n"
+"   --prefilter          Skip ahead with memchr in write exec while in a\n"
+"                        start state that is left on one character (C only)\n"
+"   --share-tables       Write identical tables of all write data statements\n"
+"                        once, defining later names as the first (C only,\n"
+"                        write data at file scope)\n"
+"   --utf8               Write ranges, numbers, dot and or expressions in\n"
+"                        code points, matched as utf-8 byte sequences\n"
 "error reporting format:\n"
 "   --error-format=gnu   file:line:column: message (default)\n"
 "   --error-format=msvc  file(line,column): message\n"
@@ -708,10 +2066,27 @@ void InputData::usage()
 "                                of the machine (depth D from start state).\n"
 "   --state-limit=L              Report fail if number of states exceeds this\n"
 "                                during compilation.\n"
+"   --memory-limit=M             Cap the graph memory of an instance that is a\n"
+"                                union. When it is exceeded the alternatives are\n"
+"                                joined with an NFA union instead. Accepts k, m\n"
+"                                and g suffixes.\n"
 "   --breadth-check=E1,E2,..     Report breadth cost of named entry points and\n"
 "                                the start state.\n"
+"   --auto-style=CORPUS          Generate, compile and time each code style on\n"
+"                                CORPUS, then use the fastest (ragel-c only)\n"
 "   --input-histogram=FN         Input char histogram for breadth check. If\n"
 "                                unspecified a flat histogram is used.\n"
+"   --input-corpus=FN            Compute the breadth check histogram from a\n"
+"                                sample of real input.\n"
+"   --input-corpus-order=N       0 for byte frequencies (default), 1 to\n"
+"                                condition on the previous byte.\n"
+"   --breadth-jobs=N             Threads used by the breadth check, 0 for one\n"
+"                                per processor, at most 8. Defaults to 1.\n"
+"libraries:\n"
+"   --write-library=FN           Write the exported machines to FN as a\n"
+"                                precompiled library\n"
+"   --load-library=FN            Define the machines of library FN in every\n"
+"                                machine specification\n"
 "testing:\n"
 "   --kelbt-frontend        Compile using original ragel + kelbt frontend\n"
 "                           Requires ragel be built with ragel + kelbt support\n"
@@ -1078,6 +2453,16 @@ void InputData::parseArgs( int argc, const char **argv )
 					condsCheckDepth = strtol( eq, 0, 10 );
 				else if ( strcmp( arg, "state-limit" ) == 0 )
 					stateLimit = strtol( eq, 0, 10 );
+				else if ( strcmp( arg, "memory-limit" ) == 0 ) {
+					char *end = 0;
+					memoryLimit = strtol( eq, &end, 10 );
+					if ( *end == 'k' || *end == 'K' )
+						memoryLimit *= 1024L;
+					else if ( *end == 'm' || *end == 'M' )
+						memoryLimit *= 1024L * 1024L;
+					else if ( *end == 'g' || *end == 'G' )
+						memoryLimit *= 1024L * 1024L * 1024L;
+				}
 
 				else if ( strcmp( arg, "breadth-check" ) == 0 ) {
 					char *ptr = 0;
@@ -1090,12 +2475,53 @@ void InputData::parseArgs( int argc, const char **argv )
 					}
 					checkBreadth = true;
 				}
+				else if ( strcmp( arg, "auto-style" ) == 0 )
+					autoStyleCorpus = strdup(eq);
+				else if ( strcmp( arg, "breadth-jobs" ) == 0 )
+					breadthJobs = strtol( eq, 0, 10 );
 				else if ( strcmp( arg, "input-histogram" ) == 0 )
 					histogramFn = strdup(eq);
+				else if ( strcmp( arg, "input-corpus" ) == 0 )
+					inputCorpusFn = strdup(eq);
+				else if ( strcmp( arg, "input-corpus-order" ) == 0 ) {
+					inputCorpusOrder = strtol( eq, 0, 10 );
+					if ( inputCorpusOrder != 0 && inputCorpusOrder != 1 ) {
+						error() << "--input-corpus-order must be 0 or 1" << endl;
+						inputCorpusOrder = 0;
+					}
+				}
+				else if ( strcmp( arg, "codegen-jobs" ) == 0 ) {
+					codegenJobs = strtol( eq, 0, 10 );
+#ifndef _WIN32
+					if ( codegenJobs <= 0 )
+						codegenJobs = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+					if ( codegenJobs < 1 )
+						codegenJobs = 1;
+				}
+				else if ( strcmp( arg, "rlhc-jobs" ) == 0 ) {
+					rlhcJobs = strtol( eq, 0, 10 );
+#ifndef _WIN32
+					if ( rlhcJobs <= 0 )
+						rlhcJobs = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+					if ( rlhcJobs < 1 )
+						rlhcJobs = 1;
+				}
+				else if ( strcmp( arg, "write-library" ) == 0 )
+					writeLibraryFn = strdup(eq);
+				else if ( strcmp( arg, "load-library" ) == 0 )
+					loadLibraryFns.append( strdup(eq) );
 				else if ( strcmp( arg, "var-backend" ) == 0 )
 					forceVar = true;
 				else if ( strcmp( arg, "no-fork" ) == 0 )
 					noFork = true;
+				else if ( strcmp( arg, "prefilter" ) == 0 )
+					prefilter = true;
+				else if ( strcmp( arg, "share-tables" ) == 0 )
+					shareTables = true;
+				else if ( strcmp( arg, "utf8" ) == 0 )
+					utf8 = true;
 				else {
 					error() << "--" << pc.paramArg << 
 							" is an invalid argument" << endl;
@@ -1184,51 +2610,372 @@ void InputData::parseArgs( int argc, const char **argv )
 	}
 }
 
+/* Read the histogram values. The count is checked against the alphabet of
+ * each machine when the breadth check runs. */
 void InputData::loadHistogram()
 {
-	const int alphsize = 256;
-
-	/* Init a default. */
-	histogram = new double[alphsize];
 	ifstream h( histogramFn );
 	if ( !h.is_open() )
 		error() << "histogram read: failed to open file: " << histogramFn << endp;
 
-	int i = 0;
 	double value;
 	while ( true ) {
-		if ( h >> value ) {
-			if ( i >= alphsize ) {
-				/* Too many items. */
-				error() << "histogram read: too many histogram values,"
-						" expecting " << alphsize << " (for char alphabet)" << endp;
-			}
-			histogram[i] = value;
-			i++;
-		}
+		if ( h >> value )
+			histogramValues.append( value );
 		else {
 			/* Read failure. */
-			if ( h.eof() ) {
-				if ( i < alphsize ) {
-					error() << "histogram read: fell short of " <<
-							alphsize << " items" << endp;
-				}
+			if ( h.eof() )
 				break;
-			}
 			else {
-				error() << "histogram read: error at item " << i << endp;
+				error() << "histogram read: error at item " <<
+						histogramValues.length() << endp;
 			}
 		}
 	}
 }
 
-void InputData::defaultHistogram()
+/* Count the bytes of the sample input, and byte pairs if a first order
+ * model was requested. */
+void InputData::loadCorpus()
+{
+	ifstream c( inputCorpusFn, ios::in | ios::binary );
+	if ( !c.is_open() )
+		error() << "corpus read: failed to open file: " << inputCorpusFn << endp;
+
+	corpusCounts = new double[256];
+	memset( corpusCounts, 0, sizeof(double) * 256 );
+
+	if ( inputCorpusOrder > 0 ) {
+		corpusPairs = new double[256 * 256];
+		memset( corpusPairs, 0, sizeof(double) * 256 * 256 );
+	}
+
+	char buf[8192];
+	int prev = -1;
+	while ( c.read( buf, sizeof(buf) ) || c.gcount() > 0 ) {
+		const unsigned char *p = (const unsigned char*)buf;
+		const unsigned char *pe = p + c.gcount();
+		for ( ; p < pe; p++ ) {
+			corpusCounts[*p] += 1;
+			if ( corpusPairs != 0 && prev >= 0 )
+				corpusPairs[prev * 256 + *p] += 1;
+			prev = *p;
+		}
+	}
+
+	if ( prev < 0 )
+		error() << "corpus read: " << inputCorpusFn << " is empty" << endp;
+}
+
+/*
+ * Precompiled machine libraries. After the magic and the version every value
+ * is a little endian 64 bit integer. Each machine is:
+ *
+ *   name-length name-bytes
+ *   is-signed min-key max-key
+ *   num-states start-state
+ *   num-final final-state...
+ *   num-trans (from to low-key high-key)...
+ *   num-actions action...
+ *   num-priors (name-length name-bytes key priority)...
+ *   num-action-ords num-prior-ords
+ *   num-embeds (type target ordering index)...
+ *
+ * An action is:
+ *
+ *   name-length name-bytes file-length file-bytes line col
+ *   num-items (type data-length data-bytes num-children)...
+ *
+ * A transition to state -1 has no target. The inline items of an action are
+ * in preorder and an item with no child list has num-children -1.
+ */
+
+static const char libraryMagic[8] = { 'R', 'A', 'G', 'E', 'L', 'L', 'I', 'B' };
+
+#define LIBRARY_VERSION 2
+
+static void writeLibLong( std::ostream &out, long long value )
+{
+	unsigned long long v = value;
+	char buf[8];
+	for ( int i = 0; i < 8; i++ )
+		buf[i] = (char)( ( v >> ( i * 8 ) ) & 0xff );
+	out.write( buf, 8 );
+}
+
+static bool readLibLong( std::istream &in, long long &value )
+{
+	unsigned char buf[8];
+	if ( !in.read( (char*)buf, 8 ) )
+		return false;
+
+	unsigned long long v = 0;
+	for ( int i = 0; i < 8; i++ )
+		v |= (unsigned long long)buf[i] << ( i * 8 );
+	value = (long long)v;
+	return true;
+}
+
+static void writeLibString( std::ostream &out, const std::string &value )
+{
+	writeLibLong( out, value.size() );
+	out.write( value.data(), value.size() );
+}
+
+static bool readLibString( std::istream &in, std::string &value )
+{
+	long long length;
+	if ( !readLibLong( in, length ) || length < 0 || length > 1024 * 1024 )
+		return false;
+
+	value.resize( length );
+	return length == 0 || in.read( &value[0], length );
+}
+
+static bool readLibLong( std::istream &in, long &value )
+{
+	long long v;
+	if ( !readLibLong( in, v ) )
+		return false;
+	value = v;
+	return true;
+}
+
+void InputData::openLibrary()
+{
+	libraryOut = new ofstream( writeLibraryFn, ios::out | ios::binary );
+	if ( !libraryOut->is_open() )
+		error() << "library write: failed to open file: " << writeLibraryFn << endp;
+
+	libraryOut->write( libraryMagic, sizeof(libraryMagic) );
+	writeLibLong( *libraryOut, LIBRARY_VERSION );
+}
+
+/* Write out the exports a section made for the library, in the order the
+ * sections were processed. */
+void InputData::writeLibExports( ParseData *pd )
+{
+	for ( Vector<LibMachine*>::Iter le = pd->libExports; le.lte(); le++ ) {
+		if ( libraryOut != 0 )
+			writeLibMachine( *le );
+		delete *le;
+	}
+	pd->libExports.empty();
+}
+
+void InputData::writeLibMachine( LibMachine *libMachine )
+{
+	ostream &out = *libraryOut;
+
+	writeLibLong( out, libMachine->name.size() );
+	out.write( libMachine->name.data(), libMachine->name.size() );
+
+	writeLibLong( out, libMachine->isSigned ? 1 : 0 );
+	writeLibLong( out, libMachine->minKey );
+	writeLibLong( out, libMachine->maxKey );
+
+	writeLibLong( out, libMachine->numStates );
+	writeLibLong( out, libMachine->startState );
+
+	writeLibLong( out, libMachine->finStates.length() );
+	for ( Vector<long>::Iter f = libMachine->finStates; f.lte(); f++ )
+		writeLibLong( out, *f );
+
+	writeLibLong( out, libMachine->trans.length() );
+	for ( Vector<LibMachine::Trans>::Iter t = libMachine->trans; t.lte(); t++ ) {
+		writeLibLong( out, t->from );
+		writeLibLong( out, t->to );
+		writeLibLong( out, t->lowKey );
+		writeLibLong( out, t->highKey );
+	}
+
+	writeLibLong( out, libMachine->actions.size() );
+	for ( size_t a = 0; a < libMachine->actions.size(); a++ ) {
+		const LibMachine::ActionDef &actionDef = libMachine->actions[a];
+		writeLibString( out, actionDef.name );
+		writeLibString( out, actionDef.fileName );
+		writeLibLong( out, actionDef.line );
+		writeLibLong( out, actionDef.col );
+
+		writeLibLong( out, actionDef.items.size() );
+		for ( size_t i = 0; i < actionDef.items.size(); i++ ) {
+			writeLibLong( out, actionDef.items[i].type );
+			writeLibString( out, actionDef.items[i].data );
+			writeLibLong( out, actionDef.items[i].numChildren );
+		}
+	}
+
+	writeLibLong( out, libMachine->priors.size() );
+	for ( size_t p = 0; p < libMachine->priors.size(); p++ ) {
+		writeLibString( out, libMachine->priors[p].name );
+		writeLibLong( out, libMachine->priors[p].key );
+		writeLibLong( out, libMachine->priors[p].priority );
+	}
+
+	writeLibLong( out, libMachine->numActionOrds );
+	writeLibLong( out, libMachine->numPriorOrds );
+
+	writeLibLong( out, libMachine->embeds.length() );
+	for ( Vector<LibMachine::Embed>::Iter e = libMachine->embeds; e.lte(); e++ ) {
+		writeLibLong( out, e->type );
+		writeLibLong( out, e->target );
+		writeLibLong( out, e->ordering );
+		writeLibLong( out, e->index );
+	}
+
+	/* The frontend child exits without closing the stream. */
+	out.flush();
+	if ( !out.good() )
+		error() << "library write: failed to write: " << writeLibraryFn << endp;
+}
+
+/* Read every machine from a library. The graph is checked here so that
+ * making it in a section can go straight to the fsm primitives. */
+void InputData::loadLibrary( const char *fn )
 {
-	/* Flat histogram. */
-	const int alphsize = 256;
-	histogram = new double[alphsize];
-	for ( int i = 0; i < alphsize; i++ ) {
-		histogram[i] = 1.0 / (double)alphsize;
+	ifstream in( fn, ios::in | ios::binary );
+	if ( !in.is_open() )
+		error() << "library read: failed to open file: " << fn << endp;
+
+	char magic[sizeof(libraryMagic)];
+	long long version;
+	if ( !in.read( magic, sizeof(magic) ) ||
+			memcmp( magic, libraryMagic, sizeof(magic) ) != 0 ||
+			!readLibLong( in, version ) )
+		error() << "library read: " << fn << " is not a ragel library" << endp;
+
+	if ( version != LIBRARY_VERSION ) {
+		error() << "library read: " << fn << " has version " << version <<
+				", expected " << LIBRARY_VERSION << endp;
+	}
+
+	while ( true ) {
+		long long nameLength;
+		if ( !readLibLong( in, nameLength ) ) {
+			if ( in.eof() && in.gcount() == 0 )
+				break;
+			error() << "library read: " << fn << ": truncated" << endp;
+		}
+
+		if ( nameLength <= 0 || nameLength > 4096 )
+			error() << "library read: " << fn << ": bad machine name" << endp;
+
+		LibMachine *libMachine = new LibMachine;
+		libMachines.append( libMachine );
+
+		libMachine->name.resize( nameLength );
+		in.read( &libMachine->name[0], nameLength );
+
+		long long isSigned, minKey, maxKey, numStates, startState;
+		long long numFinal, numTrans, v[4];
+		bool ok = readLibLong( in, isSigned ) && readLibLong( in, minKey ) &&
+				readLibLong( in, maxKey ) && readLibLong( in, numStates ) &&
+				readLibLong( in, startState ) && readLibLong( in, numFinal );
+
+		ok = ok && numStates > 0 && startState >= 0 && startState < numStates &&
+				numFinal >= 0 && numFinal <= numStates;
+
+		libMachine->isSigned = isSigned != 0;
+		libMachine->minKey = minKey;
+		libMachine->maxKey = maxKey;
+		libMachine->numStates = numStates;
+		libMachine->startState = startState;
+
+		for ( long long f = 0; ok && f < numFinal; f++ ) {
+			ok = readLibLong( in, v[0] ) && v[0] >= 0 && v[0] < numStates;
+			if ( ok )
+				libMachine->finStates.append( v[0] );
+		}
+
+		ok = ok && readLibLong( in, numTrans ) && numTrans >= 0;
+
+		/* Transitions must be grouped by source state and increase in key
+		 * order within a group. */
+		LibMachine::Trans last = { -1, -1, 0, 0 };
+		for ( long long t = 0; ok && t < numTrans; t++ ) {
+			ok = readLibLong( in, v[0] ) && readLibLong( in, v[1] ) &&
+					readLibLong( in, v[2] ) && readLibLong( in, v[3] );
+
+			LibMachine::Trans trans;
+			trans.from = v[0];
+			trans.to = v[1];
+			trans.lowKey = v[2];
+			trans.highKey = v[3];
+
+			ok = ok && trans.from >= 0 && trans.from < numStates &&
+					trans.to >= -1 && trans.to < numStates &&
+					minKey <= trans.lowKey && trans.lowKey <= trans.highKey &&
+					trans.highKey <= maxKey;
+
+			if ( ok && t > 0 ) {
+				ok = last.from < trans.from || ( last.from == trans.from &&
+						last.highKey < trans.lowKey );
+			}
+
+			if ( ok )
+				libMachine->trans.append( trans );
+			last = trans;
+		}
+
+		long long numActions, numItems, numPriors, numEmbeds;
+		ok = ok && readLibLong( in, numActions ) && numActions >= 0;
+		for ( long long a = 0; ok && a < numActions; a++ ) {
+			LibMachine::ActionDef actionDef;
+			ok = readLibString( in, actionDef.name ) &&
+					readLibString( in, actionDef.fileName ) &&
+					readLibLong( in, actionDef.line ) &&
+					readLibLong( in, actionDef.col ) &&
+					readLibLong( in, numItems ) && numItems >= 0;
+
+			for ( long long i = 0; ok && i < numItems; i++ ) {
+				LibMachine::ItemDef itemDef;
+				ok = readLibLong( in, itemDef.type ) &&
+						readLibString( in, itemDef.data ) &&
+						readLibLong( in, itemDef.numChildren ) &&
+						itemDef.numChildren >= -1;
+				if ( ok )
+					actionDef.items.push_back( itemDef );
+			}
+
+			if ( ok )
+				libMachine->actions.push_back( actionDef );
+		}
+
+		ok = ok && readLibLong( in, numPriors ) && numPriors >= 0;
+		for ( long long p = 0; ok && p < numPriors; p++ ) {
+			LibMachine::PriorDef priorDef;
+			ok = readLibString( in, priorDef.name ) &&
+					readLibLong( in, priorDef.key ) &&
+					readLibLong( in, priorDef.priority );
+			if ( ok )
+				libMachine->priors.push_back( priorDef );
+		}
+
+		ok = ok && readLibLong( in, libMachine->numActionOrds ) &&
+				readLibLong( in, libMachine->numPriorOrds ) &&
+				readLibLong( in, numEmbeds ) && numEmbeds >= 0;
+
+		for ( long long e = 0; ok && e < numEmbeds; e++ ) {
+			LibMachine::Embed embed;
+			ok = readLibLong( in, embed.type ) && readLibLong( in, embed.target ) &&
+					readLibLong( in, embed.ordering ) && readLibLong( in, embed.index );
+			if ( ok )
+				libMachine->embeds.append( embed );
+		}
+
+		ok = ok && libMachine->checkEmbeds();
+
+		if ( !ok ) {
+			error() << "library read: " << fn << ": bad machine \"" <<
+					libMachine->name << "\"" << endp;
+		}
+
+		for ( int lm = 0; lm < libMachines.length() - 1; lm++ ) {
+			if ( libMachines[lm]->name == libMachine->name ) {
+				error() << "library read: " << fn << ": machine \"" <<
+						libMachine->name << "\" previously loaded" << endp;
+			}
+		}
 	}
 }
 
@@ -1254,12 +3001,32 @@ void InputData::checkArgs()
 	if ( !frontendSpecified )
 		frontend = ReduceBased;
 
+	if ( autoStyleCorpus != 0 ) {
+		if ( hostLang->defaultOutFn != &defaultOutFnC )
+			error() << "--auto-style is only supported for C output" << endp;
+		/* The timing runs go through rlhc. */
+		if ( hostLang->backend == Direct )
+			error() << "--auto-style requires a translating host, such as ragel-c" << endp;
+#if defined(HAVE_SYS_WAIT_H)
+		if ( noFork )
+			error() << "--auto-style cannot be used with --no-fork" << endp;
+#else
+		error() << "--auto-style is not supported on this platform" << endp;
+#endif
+	}
+
 	if ( checkBreadth ) {
+		if ( histogramFn != 0 && inputCorpusFn != 0 )
+			error() << "--input-histogram and --input-corpus are exclusive" << endp;
+
 		if ( histogramFn != 0 )
 			loadHistogram();
-		else
-			defaultHistogram();
+		else if ( inputCorpusFn != 0 )
+			loadCorpus();
 	}
+
+	for ( ArgsVector::Iter ll = loadLibraryFns; ll.lte(); ll++ )
+		loadLibrary( *ll );
 }
 
 char *InputData::readInput( const char *inputFileName )
@@ -1308,6 +3075,185 @@ int InputData::runRlhc( int argc, const char **argv )
 	return exit_status;
 }
 
+/* Does the keyword start at position i of the intermediate file, as a whole
+ * word? */
+static bool rlhcKeyword( const std::string &ri, size_t i, const char *kw )
+{
+	size_t kwlen = strlen( kw );
+	if ( i == 0 || ri.compare( i, kwlen, kw ) != 0 )
+		return false;
+	if ( isalnum( ri[i-1] ) || ri[i-1] == '_' )
+		return false;
+	return i + kwlen < ri.size() &&
+			!isalnum( ri[i+kwlen] ) && ri[i+kwlen] != '_';
+}
+
+/* Places the intermediate file can be cut for separate translation: the
+ * start of each top level host block and of each top level array or value
+ * definition, so a single large write data can be divided too. Blocks of host code and inline
+ * expressions run from @{ to }@, ${ to }$ and ={ to }= and are copied
+ * through without looking inside. Elsewhere strings, comments and braces are
+ * tracked so that only the top level is considered. */
+static void rlhcSplitPoints( const std::string &ri, std::vector<size_t> &points )
+{
+	size_t len = ri.size();
+	long depth = 0;
+	size_t i = 0;
+	while ( i < len ) {
+		char c = ri[i];
+		if ( ( c == '@' || c == '$' || c == '=' ) && i + 1 < len && ri[i+1] == '{' ) {
+			char end[] = { '}', c, 0 };
+			size_t close = ri.find( end, i + 2 );
+			i = close == std::string::npos ? len : close + 2;
+		}
+		else if ( c == '/' && i + 1 < len && ri[i+1] == '*' ) {
+			size_t close = ri.find( "*/", i + 2 );
+			i = close == std::string::npos ? len : close + 2;
+		}
+		else if ( c == '/' && i + 1 < len && ri[i+1] == '/' ) {
+			size_t close = ri.find( '\n', i + 2 );
+			i = close == std::string::npos ? len : close + 1;
+		}
+		else if ( c == '"' || c == '\'' ) {
+			i += 1;
+			while ( i < len && ri[i] != c ) {
+				if ( ri[i] == '\\' )
+					i += 1;
+				i += 1;
+			}
+			i += 1;
+		}
+		else if ( c == '{' ) {
+			depth += 1;
+			i += 1;
+		}
+		else if ( c == '}' ) {
+			depth -= 1;
+			i += 1;
+		}
+		else {
+			if ( depth == 0 && ( rlhcKeyword( ri, i, "host" ) ||
+					rlhcKeyword( ri, i, "array" ) || rlhcKeyword( ri, i, "value" ) ) )
+				points.push_back( i );
+			i += 1;
+		}
+	}
+}
+
+/* Translate the intermediate file in pieces, --rlhc-jobs at a time. Each
+ * piece is a run of whole top level items, translated by its own rlhc in a
+ * forked process, and the results are joined in order. */
+int InputData::runRlhcParallel()
+{
+	std::ifstream in( genOutputFileName.c_str(), std::ios::binary );
+	std::ostringstream buf;
+	buf << in.rdbuf();
+	std::string ri = buf.str();
+
+	std::vector<size_t> points;
+	rlhcSplitPoints( ri, points );
+
+	/* Group the items into pieces of about the same size. */
+	std::vector<size_t> cuts;
+	size_t target = ri.size() / rlhcJobs + 1;
+	size_t last = 0;
+	cuts.push_back( 0 );
+	for ( size_t i = 0; i < points.size(); i++ ) {
+		if ( points[i] - last >= target ) {
+			cuts.push_back( points[i] );
+			last = points[i];
+		}
+	}
+	cuts.push_back( ri.size() );
+
+	long pieces = cuts.size() - 1;
+	if ( printStatistics )
+		stats() << "rlhc-pieces\t" << pieces << endl;
+
+	std::vector<std::string> inFns, outFns;
+	for ( long i = 0; i < pieces; i++ ) {
+		std::ostringstream suffix;
+		suffix << "." << i;
+		inFns.push_back( genOutputFileName + suffix.str() );
+		outFns.push_back( origOutputFileName + suffix.str() );
+
+		std::ofstream piece( inFns[i].c_str(), std::ios::binary | std::ios::trunc );
+		piece.write( ri.data() + cuts[i], cuts[i+1] - cuts[i] );
+		if ( !piece ) {
+			error() << "could not write " << inFns[i] << endl;
+			for ( long j = 0; j <= i; j++ )
+				unlink( inFns[j].c_str() );
+			return 1;
+		}
+	}
+
+	int es = 0;
+	long next = 0;
+#if defined(HAVE_SYS_WAIT_H)
+	long running = 0;
+	while ( !noFork && ( next < pieces || running > 0 ) ) {
+		if ( next < pieces && running < rlhcJobs ) {
+			const char *_argv[] = { "rlhc",
+					inFns[next].c_str(), outFns[next].c_str(), 0 };
+
+			pid_t pid = fork();
+			if ( pid == 0 )
+				exit( runRlhc( 3, _argv ) );
+			if ( pid < 0 ) {
+				/* Could not fork, do it here. */
+				int pes = runRlhc( 3, _argv );
+				if ( es == 0 )
+					es = pes;
+			}
+			else {
+				running += 1;
+			}
+			next += 1;
+			continue;
+		}
+
+		int status = 0;
+		if ( wait( &status ) < 0 )
+			break;
+		running -= 1;
+
+		if ( WIFSIGNALED(status) ) {
+			error() << "rlhc stopped by signal: " << WTERMSIG(status) << std::endl;
+			if ( es == 0 )
+				es = -1;
+		}
+		else if ( es == 0 ) {
+			es = WEXITSTATUS( status );
+		}
+	}
+#endif
+
+	/* Without fork the pieces are translated here, in turn. */
+	for ( ; next < pieces && es == 0; next++ ) {
+		const char *_argv[] = { "rlhc", inFns[next].c_str(), outFns[next].c_str(), 0 };
+		es = runRlhc( 3, _argv );
+	}
+
+	if ( es == 0 ) {
+		std::ofstream out( origOutputFileName.c_str(), std::ios::binary | std::ios::trunc );
+		for ( long i = 0; i < pieces; i++ ) {
+			std::ifstream piece( outFns[i].c_str(), std::ios::binary );
+			out << piece.rdbuf();
+		}
+		if ( !out ) {
+			error() << "could not write " << origOutputFileName << endl;
+			es = 1;
+		}
+	}
+
+	for ( long i = 0; i < pieces; i++ ) {
+		unlink( inFns[i].c_str() );
+		unlink( outFns[i].c_str() );
+	}
+
+	return es;
+}
+
 /* Run a job (frontend or backend). If we want forks then we return the result
  * via the process's exit code. otherwise it comes back on the stack. */
 int InputData::runJob( const char *what, IdProcess idProcess, int argc, const char **argv )
@@ -1353,6 +3299,233 @@ int InputData::main( int argc, const char **argv )
 	return code;
 }
 
+/* Candidates for --auto-style. When nothing can be timed, the first one
+ * whose output fits under the size limit is used. */
+struct AutoStyle
+{
+	const char *option;
+	CodeStyle codeStyle;
+	bool needsGoto;
+};
+
+static const AutoStyle autoStyles[] = {
+	{ "-G2", GenIpGoto,     true },
+	{ "-G1", GenGotoExp,    true },
+	{ "-F1", GenFlatExp,    false },
+	{ "-G0", GenGotoLoop,   true },
+	{ "-T1", GenBinaryExp,  false },
+	{ "-F0", GenFlatLoop,   false },
+	{ "-T0", GenBinaryLoop, false },
+};
+
+#define AUTO_STYLE_SIZE_LIMIT ( 1024L * 1024L )
+#define AUTO_STYLE_RUNS 3
+
+#if defined(HAVE_SYS_WAIT_H)
+static long fileSize( const char *fileName )
+{
+	struct stat st;
+	if ( stat( fileName, &st ) != 0 )
+		return -1;
+	return st.st_size;
+}
+
+static double wallClock()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Run a program with stdin from a file (or left alone) and its output thrown
+ * away. No shell is involved, so paths need no quoting. True if it exits with
+ * status zero. */
+static bool runProgram( const std::vector<std::string> &args, const char *input )
+{
+	std::vector<char*> argv;
+	for ( size_t i = 0; i < args.size(); i++ )
+		argv.push_back( const_cast<char*>( args[i].c_str() ) );
+	argv.push_back( 0 );
+
+	pid_t pid = fork();
+	if ( pid < 0 )
+		return false;
+
+	if ( pid == 0 ) {
+		int null = open( "/dev/null", O_WRONLY );
+		if ( null >= 0 ) {
+			dup2( null, 1 );
+			dup2( null, 2 );
+			close( null );
+		}
+		if ( input != 0 ) {
+			int in = open( input, O_RDONLY );
+			if ( in < 0 )
+				_exit( 127 );
+			dup2( in, 0 );
+			close( in );
+		}
+		execvp( argv[0], &argv[0] );
+		_exit( 127 );
+	}
+
+	int status = 0;
+	if ( waitpid( pid, &status, 0 ) != pid )
+		return false;
+	return WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+#endif
+
+/* Run the frontend and rlhc once for every code style into scratch files,
+ * build each with the C compiler and time it on the corpus. Leaves codeStyle
+ * set to the winner. The output must build into a program that reads its
+ * input on stdin. */
+void InputData::chooseAutoStyle()
+{
+#if defined(HAVE_SYS_WAIT_H)
+	/* CC may carry options, as in "gcc -m32". */
+	std::vector<std::string> cc;
+	std::istringstream ccWords( getenv( "CC" ) != 0 ? getenv( "CC" ) : "" );
+	std::string word;
+	while ( ccWords >> word )
+		cc.push_back( word );
+	if ( cc.empty() )
+		cc.push_back( "cc" );
+
+	const long numStyles = sizeof(autoStyles) / sizeof(AutoStyle);
+	double times[numStyles];
+	long sizes[numStyles];
+
+	const char *realOutputFileName = outputFileName;
+	std::string realGen = genOutputFileName;
+	std::string realOrig = origOutputFileName;
+	CodeStyle realCodeStyle = codeStyle;
+
+	long fastest = -1;
+	for ( long s = 0; s < numStyles; s++ ) {
+		times[s] = -1;
+		sizes[s] = -1;
+
+		if ( autoStyles[s].needsGoto && hostLang->feature != GotoFeature )
+			continue;
+
+		std::string stem = realOrig + ".style" + ( autoStyles[s].option + 1 );
+		std::string ri = stem + ".ri";
+		std::string src = stem + ".c";
+		std::string bin = stem + ".bin";
+
+		codeStyle = autoStyles[s].codeStyle;
+		outputFileName = ri.c_str();
+		genOutputFileName = ri;
+		origOutputFileName = src;
+
+		int es = runJob( "frontend", &InputData::runFrontend, 0, 0 );
+		if ( es == 0 ) {
+			const char *_argv[] = { "rlhc", ri.c_str(), src.c_str(), 0 };
+			es = runJob( "rlhc", &InputData::runRlhc, 3, _argv );
+		}
+
+		if ( es == 0 ) {
+			sizes[s] = fileSize( src.c_str() );
+
+			std::vector<std::string> compile = cc;
+			compile.push_back( "-O2" );
+			compile.push_back( "-o" );
+			compile.push_back( bin );
+			compile.push_back( src );
+
+			/* A path without a slash would be looked up in PATH. */
+			std::vector<std::string> run;
+			run.push_back( bin.find( '/' ) == std::string::npos ? "./" + bin : bin );
+
+			if ( runProgram( compile, 0 ) ) {
+				/* Best of a few runs. */
+				for ( int r = 0; r < AUTO_STYLE_RUNS; r++ ) {
+					double start = wallClock();
+					if ( !runProgram( run, autoStyleCorpus ) ) {
+						times[s] = -1;
+						break;
+					}
+					double t = wallClock() - start;
+					if ( times[s] < 0 || t < times[s] )
+						times[s] = t;
+				}
+			}
+
+			if ( times[s] >= 0 && ( fastest < 0 || times[s] < times[fastest] ) )
+				fastest = s;
+		}
+
+		unlink( ri.c_str() );
+		unlink( src.c_str() );
+		unlink( bin.c_str() );
+	}
+
+	outputFileName = realOutputFileName;
+	genOutputFileName = realGen;
+	origOutputFileName = realOrig;
+	codeStyle = realCodeStyle;
+
+	const char *how = "timed";
+	if ( fastest < 0 ) {
+		/* Nothing could be timed. Estimate from the generated size. */
+		how = "estimated from size";
+		for ( long s = 0; s < numStyles; s++ ) {
+			if ( sizes[s] >= 0 && sizes[s] <= AUTO_STYLE_SIZE_LIMIT ) {
+				fastest = s;
+				break;
+			}
+		}
+
+		for ( long s = 0; fastest < 0 && s < numStyles; s++ ) {
+			if ( sizes[s] >= 0 && ( fastest < 0 || sizes[s] < sizes[fastest] ) )
+				fastest = s;
+		}
+	}
+
+	if ( fastest < 0 )
+		error() << "--auto-style: no code style could be generated" << endp;
+
+	codeStyle = autoStyles[fastest].codeStyle;
+
+	std::ostringstream report;
+	report << "/* ragel --auto-style: " << autoStyles[fastest].option <<
+			" (" << how << ")\n";
+	for ( long s = 0; s < numStyles; s++ ) {
+		report << " *   " << autoStyles[s].option << "  ";
+		if ( times[s] >= 0 )
+			report << std::fixed << std::setprecision(4) << times[s] << "s  ";
+		else
+			report << "untimed  ";
+		if ( sizes[s] >= 0 )
+			report << sizes[s] << " bytes";
+		else
+			report << "not generated";
+		report << "\n";
+	}
+	report << " */\n";
+	autoStyleReport = report.str();
+
+	if ( printStatistics )
+		stats() << "auto-style\t" << autoStyles[fastest].option << endl;
+#endif
+}
+
+/* Put the --auto-style decision at the head of the final output. */
+void InputData::writeAutoStyleReport()
+{
+	std::ifstream in( origOutputFileName.c_str(), std::ios::binary );
+	if ( !in.is_open() )
+		return;
+
+	std::ostringstream body;
+	body << in.rdbuf();
+	in.close();
+
+	std::ofstream out( origOutputFileName.c_str(), std::ios::binary | std::ios::trunc );
+	out << autoStyleReport << body.str();
+}
+
 int InputData::rlhcMain( int argc, const char **argv )
 {
 	int code = 0;
@@ -1362,17 +3535,30 @@ int InputData::rlhcMain( int argc, const char **argv )
 		makeDefaultFileName();
 		makeTranslateOutputFileName();
 
+		if ( autoStyleCorpus != 0 )
+			chooseAutoStyle();
+
 		int es = runJob( "frontend", &InputData::runFrontend, 0, 0 );
 
 		if ( es != 0 )
 			return es;
 
-		/* rlhc <input> <output> */
-		const char *_argv[] = { "rlhc",
-				genOutputFileName.c_str(),
-				origOutputFileName.c_str(), 0 };
+		if ( rlhcJobs > 1 ) {
+			es = runRlhcParallel();
+		}
+		else {
+			/* rlhc <input> <output> */
+			const char *_argv[] = { "rlhc",
+					genOutputFileName.c_str(),
+					origOutputFileName.c_str(), 0 };
+
+			es = runJob( "rlhc", &InputData::runRlhc, 3, _argv );
+		}
+
+		if ( es == 0 && autoStyleReport.size() > 0 )
+			writeAutoStyleReport();
 
-		return runJob( "rlhc", &InputData::runRlhc, 3, _argv );
+		return es;
 	}
 	catch ( const AbortCompile &ac ) {
 		code = ac.code;
@@ -26,8 +26,14 @@
 #include "nragel.h"
 #include <libfsm/gendata.h>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <time.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 struct ParseData;
 struct Parser6;
@@ -36,6 +42,7 @@ struct CondAp;
 struct ActionTable;
 struct Section;
 struct LangFuncs;
+struct LibMachine;
 
 void translatedHostData( ostream &out, const string &data );
 
@@ -46,6 +53,9 @@ struct InputItem
 		section(0),
 		pd(0),
 		parser(0),
+		dataStart(0),
+		dataLength(0),
+		streamed(false),
 		processed(false)
 	{}
 
@@ -63,6 +73,14 @@ struct InputItem
 	Parser6 *parser;
 	std::vector<std::string> writeArgs;
 
+	/* Host data can refer to a range of the mapped input instead of holding a
+	 * copy in data. */
+	long dataStart;
+	long dataLength;
+
+	/* Host data already written out while parsing. */
+	bool streamed;
+
 	InputLoc loc;
 	bool processed;
 
@@ -97,6 +115,42 @@ typedef DList<InputItem> InputItemList;
 typedef DList<IncItem> IncItemList;
 typedef Vector<const char *> ArgsVector;
 
+/* Interned names. Each distinct name gets a small integer id, found by
+ * hashing, so tables of names can be indexed by id instead of searched by
+ * string. There is one table for the whole input. Sections build their name
+ * trees on the codegen workers, so it is locked. */
+struct SymbolTable
+{
+	SymbolTable();
+	~SymbolTable();
+
+	int intern( const std::string &name );
+	int find( const std::string &name );
+
+private:
+	SymbolTable( const SymbolTable & );
+	SymbolTable &operator=( const SymbolTable & );
+
+	struct Symbol
+	{
+		std::string name;
+		unsigned long hash;
+		int next;
+	};
+
+	static unsigned long hash( const std::string &name );
+	int lookup( const std::string &name, unsigned long h );
+	void rehash();
+
+	/* Symbols by id, chained from the buckets. */
+	std::vector<Symbol> symbols;
+	std::vector<int> buckets;
+
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+#endif
+};
+
 struct Section
 {
 	Section( std::string sectionName )
@@ -167,6 +221,34 @@ struct IncludeRec
 
 };
 
+/* Where a set of include path checks found a file, and the modification time
+ * the file had. */
+struct IncludeLocation
+{
+	long found;
+	std::string path;
+	time_t mtime;
+};
+
+/* The tokens an import scan passed on. Later imports of the same unchanged
+ * file replay them instead of scanning again. */
+struct ImportResult
+{
+	struct Token
+	{
+		int type;
+		bool hasData;
+		std::string data;
+	};
+
+	time_t mtime;
+	std::vector<Token> tokens;
+
+	void append( int type, const char *start, const char *end );
+};
+
+bool fileModTime( const char *path, time_t &mtime );
+
 struct InputData
 :
 	public FsmGbl
@@ -187,6 +269,7 @@ struct InputData
 		curItem(0),
 		lastFlush(0),
 		codeStyle(GenBinaryLoop),
+		autoStyleCorpus(0),
 		dotGenPd(0),
 		machineSpec(0),
 		machineName(0),
@@ -204,13 +287,28 @@ struct InputData
 		condsCheckDepth(-1),
 		transSpanDepth(6),
 		stateLimit(0),
+		memoryLimit(0),
 		checkBreadth(0),
+		breadthJobs(1),
 		varBackend(false),
 		histogramFn(0),
-		histogram(0),
+		inputCorpusFn(0),
+		inputCorpusOrder(0),
+		corpusCounts(0),
+		corpusPairs(0),
+		writeLibraryFn(0),
+		libraryOut(0),
+		codegenJobs(1),
+		rlhcJobs(1),
 		input(0),
+		inputMap(0),
+		inputMapLength(0),
+		inputMapOwned(false),
 		forceVar(false),
 		noFork(false),
+		prefilter(false),
+		shareTables(false),
+		utf8(false),
 		utf8BomPresent(false)
 	{}
 
@@ -256,6 +354,8 @@ struct InputData
 	SectionDict sectionDict;
 	SectionList sectionList;
 
+	SymbolTable symbols;
+
 	ArgsVector includePaths;
 
 	bool isBreadthLabel( const string &label );
@@ -264,6 +364,11 @@ struct InputData
 	/* Target language and output style. */
 	CodeStyle codeStyle;
 
+	/* Sample input for --auto-style, and the table of results written to the
+	 * head of the output. */
+	const char *autoStyleCorpus;
+	std::string autoStyleReport;
+
 	ParseData *dotGenPd;
 
 	const char *machineSpec;
@@ -291,20 +396,62 @@ struct InputData
 	long condsCheckDepth;
 	long transSpanDepth;
 	long stateLimit;
+	long memoryLimit;
 	bool checkBreadth;
+	long breadthJobs;
 
 	bool varBackend;
 
 	const char *histogramFn;
-	double *histogram;
+	Vector<double> histogramValues;
+
+	/* Sample input for the breadth check. Byte counts, and for the first
+	 * order model, counts of byte pairs indexed by prev * 256 + cur. */
+	const char *inputCorpusFn;
+	long inputCorpusOrder;
+	double *corpusCounts;
+	double *corpusPairs;
+
+	/* Precompiled machine libraries. Exports are written to writeLibraryFn,
+	 * machines from the loaded libraries are defined in every section. */
+	const char *writeLibraryFn;
+	std::ofstream *libraryOut;
+	ArgsVector loadLibraryFns;
+	Vector<LibMachine*> libMachines;
+
+	/* Threads that build, reduce and analyze sections. With more than one,
+	 * sections are held until the input is parsed, then generated together
+	 * and written out in input order. */
+	long codegenJobs;
+	Vector<ParseData*> pendingSections;
+
+	/* Translators run at once on pieces of the intermediate file. */
+	long rlhcJobs;
 
 	const char *input;
 
+	/* The root input, kept in memory so host data can refer to it. */
+	const char *inputMap;
+	long inputMapLength;
+	bool inputMapOwned;
+
 	Vector<const char**> streamFileNames;
 
 	bool forceVar;
 	bool noFork;
 
+	/* Skip ahead with memchr in write exec where the start state allows. */
+	bool prefilter;
+
+	/* Write each distinct table once across all sections. Maps the type and
+	 * contents of a table to the name it was first written under. */
+	bool shareTables;
+	std::map<std::string, std::string> sharedTables;
+
+	/* Ranges, numbers, dot and or expressions are in code points, matched as
+	 * their utf-8 byte sequences. */
+	bool utf8;
+
 	/* Did the input file have a byte order mark? */
 	bool utf8BomPresent;
 
@@ -314,7 +461,19 @@ struct InputData
 	void makeTranslateOutputFileName();
 	void flushRemaining();
 	void makeFirstInputItem();
-	void writeStatement( CodeGenData *cgd, InputLoc &loc, int nargs,
+	void writeHostCode( const std::string &code, const InputLoc &loc );
+	void writeSharedData( CodeGenData *cgd );
+	void writeExecParallel( ParseData *pd, CodeGenData *cgd, InputLoc &loc );
+	void writeExecLazy( ParseData *pd, CodeGenData *cgd, InputLoc &loc );
+	bool writeExecPrefilter( ParseData *pd, CodeGenData *cgd, InputLoc &loc );
+	void writeBuffer( ParseData *pd, CodeGenData *cgd, InputLoc &loc );
+	bool checkSnapshot( ParseData *pd, InputLoc &loc, const char *what );
+	void writeStateSize( ParseData *pd, CodeGenData *cgd, InputLoc &loc );
+	void writeSave( ParseData *pd, CodeGenData *cgd, InputLoc &loc,
+			int nargs, std::vector<std::string> &args );
+	void writeRestore( ParseData *pd, CodeGenData *cgd, InputLoc &loc,
+			int nargs, std::vector<std::string> &args );
+	void writeStatement( ParseData *pd, CodeGenData *cgd, InputLoc &loc, int nargs,
 		std::vector<std::string> &args, bool generateDot, const HostLang *hostLang );
 	void writeOutput();
 	void makeDefaultFileName();
@@ -326,9 +485,20 @@ struct InputData
 	void prepareAllMachines();
 
 	void writeOutput( InputItem *ii );
+	void writeItemHead( InputItem *ii );
 	void writeLanguage( std::ostream &out );
 
+	void mapInput();
+	void unmapInput();
+	void appendHostData( InputItem *ii, const char *data, long length, long offset );
+	std::string hostData( InputItem *ii );
+
 	bool checkLastRef( InputItem *ii );
+	bool prepareSection( ParseData *pd );
+	bool reduceSection( ParseData *pd );
+	bool generateSection( ParseData *pd );
+	bool generatePending();
+	void releaseSection( InputItem *ii );
 
 	void parseKelbt();
 	void processDot();
@@ -337,7 +507,12 @@ struct InputData
 	void writeDot( std::ostream &out );
 
 	void loadHistogram();
-	void defaultHistogram();
+	void loadCorpus();
+
+	void loadLibrary( const char *fn );
+	void openLibrary();
+	void writeLibMachine( LibMachine *libMachine );
+	void writeLibExports( ParseData *pd );
 
 	void parseArgs( int argc, const char **argv );
 	void checkArgs();
@@ -353,11 +528,22 @@ struct InputData
 	char *readInput( const char *inputFileName );
 
 	const char **makeIncludePathChecks( const char *curFileName, const char *fileName );
+	const char **makeFileChecks( const char *fileName );
 	std::ifstream *tryOpenInclude( const char **pathChecks, long &found );
+
+	/* Per-process caches of include resolution and import scans, so sections
+	 * that include the same file don't repeat the work. */
+	std::map<std::string, const char**> includeChecks;
+	std::map<std::string, IncludeLocation> includeLocations;
+	std::map<std::string, ImportResult> importResults;
+
+	ImportResult *findImport( const char *path );
+	ImportResult *newImport( const char *path );
 	int main( int argc, const char **argv );
 
 	int runFrontend( int argc, const char **argv );
 	int runRlhc( int argc, const char **argv );
+	int runRlhcParallel();
 
 	typedef int (InputData::*IdProcess)( int argc, const char **argv );
 
@@ -365,6 +551,8 @@ struct InputData
 			int argc, const char **argv );
 
 	int rlhcMain( int argc, const char **argv );
+	void chooseAutoStyle();
+	void writeAutoStyleReport();
 };
 
 
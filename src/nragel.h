@@ -38,6 +38,8 @@ struct HostLang
 	GenLineDirectiveT genLineDirective;
 };
 
+const char *defaultOutFnC( const char *inputFileName );
+
 void genLineDirectiveC( std::ostream &out, bool nld, int line, const char *file );
 void genLineDirectiveAsm( std::ostream &out, bool nld, int line, const char *file );
 void genLineDirectiveTrans( std::ostream &out, bool nld, int line, const char *file );
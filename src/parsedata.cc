@@ -25,6 +25,14 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
+#include <map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #include <colm/tree.h>
 #include <libfsm/ragel.h>
@@ -99,6 +107,13 @@ int countTransitions( FsmAp *fsm )
 	return numTrans;
 }
 
+/* Approximate bytes held by the graph's states and transitions. */
+long graphMemory( FsmAp *fsm )
+{
+	return fsm->stateList.length() * sizeof(StateAp) +
+			countTransitions( fsm ) * sizeof(TransDataAp);
+}
+
 Key makeFsmKeyHex( char *str, const InputLoc &loc, ParseData *pd )
 {
 	/* Reset errno so we can check for overflow or underflow. In the event of
@@ -111,7 +126,7 @@ Key makeFsmKeyHex( char *str, const InputLoc &loc, ParseData *pd )
 	unsigned long ul = strtoul( str, 0, 16 );
 
 	if ( errno == ERANGE || ( unusedBits && ul >> (size * 8) ) ) {
-		pd->id->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
+		pd->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
 		ul = 1 << (size * 8);
 	}
 
@@ -134,12 +149,12 @@ Key makeFsmKeyDec( char *str, const InputLoc &loc, ParseData *pd )
 
 		/* Check for underflow. */
 		if ( ( errno == ERANGE && ll < 0 ) || ll < minVal ) {
-			pd->id->error(loc) << "literal " << str << " underflows the alphabet type" << endl;
+			pd->error(loc) << "literal " << str << " underflows the alphabet type" << endl;
 			ll = minVal;
 		}
 		/* Check for overflow. */
 		else if ( ( errno == ERANGE && ll > 0 ) || ll > maxVal ) {
-			pd->id->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
+			pd->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
 			ll = maxVal;
 		}
 
@@ -156,12 +171,12 @@ Key makeFsmKeyDec( char *str, const InputLoc &loc, ParseData *pd )
 
 		/* Check for underflow. */
 		if ( ( errno == ERANGE && ull < 0 ) || ull < minVal ) {
-			pd->id->error(loc) << "literal " << str << " underflows the alphabet type" << endl;
+			pd->error(loc) << "literal " << str << " underflows the alphabet type" << endl;
 			ull = minVal;
 		}
 		/* Check for overflow. */
 		else if ( ( errno == ERANGE && ull > 0 ) || ull > maxVal ) {
-			pd->id->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
+			pd->error(loc) << "literal " << str << " overflows the alphabet type" << endl;
 			ull = maxVal;
 		}
 
@@ -251,144 +266,457 @@ void makeFsmUniqueKeyArray( KeySet &result, const char *data, int len,
 	}
 }
 
+/* Largest code point of each utf-8 sequence length. */
+static const long utf8Max[] = { 0x7f, 0x7ff, 0xffff, 0x10ffff };
+
+static int encodeUtf8( long cp, unsigned char *bytes )
+{
+	if ( cp <= 0x7f ) {
+		bytes[0] = cp;
+		return 1;
+	}
+	else if ( cp <= 0x7ff ) {
+		bytes[0] = 0xc0 | ( cp >> 6 );
+		bytes[1] = 0x80 | ( cp & 0x3f );
+		return 2;
+	}
+	else if ( cp <= 0xffff ) {
+		bytes[0] = 0xe0 | ( cp >> 12 );
+		bytes[1] = 0x80 | ( ( cp >> 6 ) & 0x3f );
+		bytes[2] = 0x80 | ( cp & 0x3f );
+		return 3;
+	}
+	else {
+		bytes[0] = 0xf0 | ( cp >> 18 );
+		bytes[1] = 0x80 | ( ( cp >> 12 ) & 0x3f );
+		bytes[2] = 0x80 | ( ( cp >> 6 ) & 0x3f );
+		bytes[3] = 0x80 | ( cp & 0x3f );
+		return 4;
+	}
+}
+
+/* Decode the code point starting at pos, advancing pos past it. Returns -1
+ * for a malformed sequence, leaving pos on the next byte. */
+long decodeUtf8( const char *data, long length, long &pos )
+{
+	unsigned char c = data[pos++];
+	long cp;
+	int follow;
+	if ( c < 0x80 )
+		return c;
+	else if ( ( c & 0xe0 ) == 0xc0 ) {
+		cp = c & 0x1f;
+		follow = 1;
+	}
+	else if ( ( c & 0xf0 ) == 0xe0 ) {
+		cp = c & 0x0f;
+		follow = 2;
+	}
+	else if ( ( c & 0xf8 ) == 0xf0 ) {
+		cp = c & 0x07;
+		follow = 3;
+	}
+	else {
+		return -1;
+	}
+
+	for ( int i = 0; i < follow; i++ ) {
+		if ( pos >= length || ( data[pos] & 0xc0 ) != 0x80 )
+			return -1;
+		cp = ( cp << 6 ) | ( data[pos++] & 0x3f );
+	}
+
+	/* Overlong forms, surrogates and out of range values. */
+	if ( cp <= utf8Max[follow-1] || ( cp >= 0xd800 && cp <= 0xdfff ) || cp > 0x10ffff )
+		return -1;
+
+	return cp;
+}
+
+/* Add the byte sequences of the code points low to high to a union. The
+ * range is split until every piece has the same encoded length and differs
+ * only in a trailing run of continuation bytes, so each piece is a sequence
+ * of byte ranges. */
+static void utf8RangeUnion( ParseData *pd, FsmAp *&result, long low, long high )
+{
+	if ( low > high )
+		return;
+
+	/* Surrogates have no encoding. */
+	if ( low <= 0xdfff && high >= 0xd800 ) {
+		utf8RangeUnion( pd, result, low, 0xd7ff );
+		utf8RangeUnion( pd, result, 0xe000, high );
+		return;
+	}
+
+	for ( int i = 0; i < 3; i++ ) {
+		if ( low <= utf8Max[i] && high > utf8Max[i] ) {
+			utf8RangeUnion( pd, result, low, utf8Max[i] );
+			utf8RangeUnion( pd, result, utf8Max[i] + 1, high );
+			return;
+		}
+	}
+
+	if ( high > 0x7f ) {
+		for ( int i = 1; i < 4; i++ ) {
+			long mask = ( 1L << ( 6 * i ) ) - 1;
+			if ( ( low & ~mask ) != ( high & ~mask ) ) {
+				if ( ( low & mask ) != 0 ) {
+					utf8RangeUnion( pd, result, low, low | mask );
+					utf8RangeUnion( pd, result, ( low | mask ) + 1, high );
+					return;
+				}
+				if ( ( high & mask ) != mask ) {
+					utf8RangeUnion( pd, result, low, ( high & ~mask ) - 1 );
+					utf8RangeUnion( pd, result, high & ~mask, high );
+					return;
+				}
+			}
+		}
+	}
+
+	unsigned char lowBytes[4], highBytes[4];
+	int length = encodeUtf8( low, lowBytes );
+	encodeUtf8( high, highBytes );
+
+	FsmAp *seq = 0;
+	for ( int i = 0; i < length; i++ ) {
+		FsmAp *range = FsmAp::rangeFsm( pd->fsmCtx,
+				makeFsmKeyChar( (char)lowBytes[i], pd ),
+				makeFsmKeyChar( (char)highBytes[i], pd ) );
+		if ( seq == 0 )
+			seq = range;
+		else {
+			FsmRes res = FsmAp::concatOp( seq, range );
+			seq = res.fsm;
+		}
+	}
+
+	if ( result == 0 )
+		result = seq;
+	else {
+		FsmRes res = FsmAp::unionOp( result, seq );
+		result = res.fsm;
+	}
+}
+
+/* Make a machine matching the utf-8 encoding of any one code point in the
+ * range low to high. */
+FsmAp *makeUtf8RangeFsm( ParseData *pd, long low, long high )
+{
+	FsmAp *result = 0;
+	utf8RangeUnion( pd, result, low, high );
+	if ( result == 0 )
+		return FsmAp::emptyFsm( pd->fsmCtx );
+
+	result->minimizePartition2();
+	return result;
+}
+
+/* Check that utf-8 machines can be made in this section. */
+bool checkUtf8Alphabet( ParseData *pd, const InputLoc &loc )
+{
+	if ( pd->alphType->size != 1 ) {
+		pd->error(loc) << "--utf8 requires a single byte alphabet type" << endl;
+		return false;
+	}
+	return true;
+}
+
+/* Inline items that can be stored in a library, by their code in the file.
+ * None of them refer to states or to data of the parse. */
+static const InlineItem::Type libItemTypes[] = {
+	InlineItem::Text, InlineItem::Hold, InlineItem::Exec,
+	InlineItem::PChar, InlineItem::Char, InlineItem::Curs,
+	InlineItem::Break, InlineItem::Nbreak
+};
+
+static const long numLibItemTypes = sizeof(libItemTypes) / sizeof(InlineItem::Type);
+
+/* Rebuild an inline item and its children from the items in preorder. */
+static InlineItem *makeLibInlineItem( const InputLoc &loc,
+		const std::vector<LibMachine::ItemDef> &items, size_t &pos )
+{
+	const LibMachine::ItemDef &itemDef = items[pos++];
+	InlineItem *item = new InlineItem( loc, itemDef.data, libItemTypes[itemDef.type] );
+	if ( itemDef.numChildren >= 0 ) {
+		item->children = new InlineList;
+		for ( long c = 0; c < itemDef.numChildren; c++ )
+			item->children->append( makeLibInlineItem( loc, items, pos ) );
+	}
+	return item;
+}
+
+/* Check what a library file gave for the actions and priorities, so making
+ * the machine can trust it. */
+bool LibMachine::checkEmbeds()
+{
+	for ( size_t a = 0; a < actions.size(); a++ ) {
+		/* Every child count must be covered by the items after it. */
+		long need = 0;
+		for ( size_t i = 0; i < actions[a].items.size(); i++ ) {
+			const ItemDef &itemDef = actions[a].items[i];
+			if ( itemDef.type < 0 || itemDef.type >= numLibItemTypes )
+				return false;
+			if ( need > 0 )
+				need -= 1;
+			if ( itemDef.numChildren > 0 )
+				need += itemDef.numChildren;
+		}
+		if ( need > 0 )
+			return false;
+	}
+
+	for ( Vector<Embed>::Iter e = embeds; e.lte(); e++ ) {
+		bool onTrans = e->type == TransAction || e->type == TransPrior;
+		bool isPrior = e->type == TransPrior || e->type == OutPrior;
+		if ( e->type < TransAction || e->type > OutPrior ||
+				e->target < 0 || e->target >= ( onTrans ? trans.length() : numStates ) ||
+				e->index < 0 || e->index >= (long)( isPrior ? priors.size() : actions.size() ) ||
+				e->ordering < 0 || e->ordering >= ( isPrior ? numPriorOrds : numActionOrds ) )
+			return false;
+	}
+	return true;
+}
+
+/* Make the actions of a library machine in the section using it. */
+Action **LibMachine::makeActions( ParseData *pd )
+{
+	Action **actionMap = new Action*[actions.size()];
+	for ( size_t a = 0; a < actions.size(); a++ ) {
+		InputLoc loc;
+		loc.fileName = actions[a].fileName.c_str();
+		loc.line = actions[a].line;
+		loc.col = actions[a].col;
+
+		size_t pos = 0;
+		InlineList *inlineList = new InlineList;
+		while ( pos < actions[a].items.size() )
+			inlineList->append( makeLibInlineItem( loc, actions[a].items, pos ) );
+
+		Action *action = new Action( loc, actions[a].name, inlineList,
+				pd->fsmCtx->nextCondId++ );
+		action->embedRoots.append( pd->rootName );
+		pd->fsmCtx->actionList.append( action );
+		actionMap[a] = action;
+	}
+	return actionMap;
+}
+
+/* Make the priority descriptors of a library machine in the section using it.
+ * Named priorities take the key the section has for the name. */
+PriorDesc *LibMachine::makePriorDescs( ParseData *pd )
+{
+	PriorDesc *priorMap = new PriorDesc[priors.size()];
+	std::map<long, int> unnamedKeys;
+	for ( size_t p = 0; p < priors.size(); p++ ) {
+		if ( priors[p].name.size() > 0 ) {
+			PriorDictEl *priorDictEl;
+			if ( pd->priorDict.insert( priors[p].name,
+					pd->fsmCtx->nextPriorKey, &priorDictEl ) )
+				pd->fsmCtx->nextPriorKey += 1;
+			priorMap[p].key = priorDictEl->value;
+		}
+		else {
+			std::map<long, int>::iterator key = unnamedKeys.find( priors[p].key );
+			if ( key == unnamedKeys.end() ) {
+				key = unnamedKeys.insert( std::make_pair(
+						priors[p].key, pd->fsmCtx->nextPriorKey++ ) ).first;
+			}
+			priorMap[p].key = key->second;
+		}
+
+		priorMap[p].priority = priors[p].priority;
+		priorMap[p].guarded = false;
+		priorMap[p].guardId = 0;
+	}
+	return priorMap;
+}
+
+/* Allocate the states of a library machine. The transitions are grouped by
+ * source state in key order, so they can be appended directly. Each use gets
+ * its own action and priority orderings, as a walk of the source would. */
+FsmAp *LibMachine::makeFsm( ParseData *pd, Action **actionMap, PriorDesc *priorMap )
+{
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	FsmAp *fsm = new FsmAp( fsmCtx );
+	StateAp **states = new StateAp*[numStates];
+	for ( long s = 0; s < numStates; s++ )
+		states[s] = fsm->addState();
+
+	for ( Vector<long>::Iter f = finStates; f.lte(); f++ )
+		fsm->setFinState( states[*f] );
+
+	for ( Vector<Trans>::Iter t = trans; t.lte(); t++ ) {
+		fsm->attachNewTrans( states[t->from], t->to >= 0 ? states[t->to] : 0,
+				Key( t->lowKey ), Key( t->highKey ) );
+	}
+
+	if ( embeds.length() > 0 ) {
+		/* The out lists now hold the transitions in library order. */
+		TransAp **transMap = new TransAp*[trans.length()];
+		long t = 0;
+		for ( long s = 0; s < numStates; s++ ) {
+			for ( TransList::Iter tr = states[s]->outList; tr.lte(); tr++ )
+				transMap[t++] = tr;
+		}
+
+		long actionOrd = fsmCtx->curActionOrd;
+		long priorOrd = fsmCtx->curPriorOrd;
+		fsmCtx->curActionOrd += numActionOrds;
+		fsmCtx->curPriorOrd += numPriorOrds;
+
+		for ( Vector<Embed>::Iter e = embeds; e.lte(); e++ ) {
+			switch ( e->type ) {
+			case TransAction:
+				transMap[e->target]->tdap()->actionTable.setAction(
+						actionOrd + e->ordering, actionMap[e->index] );
+				break;
+			case TransPrior:
+				transMap[e->target]->tdap()->priorTable.setPrior(
+						priorOrd + e->ordering, &priorMap[e->index] );
+				break;
+			case ToStateAction:
+				states[e->target]->toStateActionTable.setAction(
+						actionOrd + e->ordering, actionMap[e->index] );
+				break;
+			case FromStateAction:
+				states[e->target]->fromStateActionTable.setAction(
+						actionOrd + e->ordering, actionMap[e->index] );
+				break;
+			case EofAction:
+				states[e->target]->eofActionTable.setAction(
+						actionOrd + e->ordering, actionMap[e->index] );
+				break;
+			case OutAction:
+				states[e->target]->outActionTable.setAction(
+						actionOrd + e->ordering, actionMap[e->index] );
+				break;
+			case OutPrior:
+				states[e->target]->outPriorTable.setPrior(
+						priorOrd + e->ordering, &priorMap[e->index] );
+				break;
+			}
+		}
+
+		delete[] transMap;
+	}
+
+	fsm->setStartState( states[startState] );
+	delete[] states;
+	return fsm;
+}
+
+struct BuiltinRange
+{
+	long low, high;
+};
+
+/* Intervals of the builtin character classes, in key order. */
+static const BuiltinRange asciiRanges[] = { { 0, 127 } };
+static const BuiltinRange extendSignedRanges[] = { { -128, 127 } };
+static const BuiltinRange extendUnsignedRanges[] = { { 0, 255 } };
+static const BuiltinRange alphaRanges[] = { { 'A', 'Z' }, { 'a', 'z' } };
+static const BuiltinRange digitRanges[] = { { '0', '9' } };
+static const BuiltinRange alnumRanges[] = { { '0', '9' }, { 'A', 'Z' }, { 'a', 'z' } };
+static const BuiltinRange lowerRanges[] = { { 'a', 'z' } };
+static const BuiltinRange upperRanges[] = { { 'A', 'Z' } };
+static const BuiltinRange cntrlRanges[] = { { 0, 31 }, { 127, 127 } };
+static const BuiltinRange graphRanges[] = { { '!', '~' } };
+static const BuiltinRange printRanges[] = { { ' ', '~' } };
+static const BuiltinRange punctRanges[] = {
+		{ '!', '/' }, { ':', '@' }, { '[', '`' }, { '{', '~' } };
+static const BuiltinRange spaceRanges[] = { { '\t', '\r' }, { ' ', ' ' } };
+static const BuiltinRange xdigitRanges[] = { { '0', '9' }, { 'A', 'F' }, { 'a', 'f' } };
+
+#define BUILTIN_RANGES( ranges ) ranges, sizeof(ranges) / sizeof(BuiltinRange)
+
+/* One character from any of the intervals. This is the machine that the
+ * union of the single ranges minimizes to: a start state and a final state. */
+static FsmAp *builtinRangesFsm( FsmCtx *fsmCtx, const BuiltinRange *ranges, int nranges )
+{
+	FsmAp *fsm = new FsmAp( fsmCtx );
+	StateAp *start = fsm->addState();
+	StateAp *finState = fsm->addState();
+	fsm->setStartState( start );
+	fsm->setFinState( finState );
+
+	for ( int r = 0; r < nranges; r++ )
+		fsm->attachNewTrans( start, finState, Key( ranges[r].low ), Key( ranges[r].high ) );
+
+	return fsm;
+}
+
 /* Make a builtin type. Depends on the signed nature of the alphabet type. */
-FsmAp *makeBuiltin( BuiltinMachine builtin, ParseData *pd )
+static FsmAp *makeBuiltinFsm( BuiltinMachine builtin, ParseData *pd )
 {
-	/* FsmAp created to return. */
-	FsmAp *retFsm = 0;
-	bool isSigned = pd->fsmCtx->keyOps->isSigned;
+	FsmCtx *fsmCtx = pd->fsmCtx;
+	bool isSigned = fsmCtx->keyOps->isSigned;
 
 	switch ( builtin ) {
-	case BT_Any: {
+	case BT_Any:
 		/* All characters. */
-		retFsm = FsmAp::dotFsm( pd->fsmCtx );
-		break;
-	}
-	case BT_Ascii: {
+		return FsmAp::dotFsm( fsmCtx );
+	case BT_Ascii:
 		/* Ascii characters 0 to 127. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, 0, 127 );
-		break;
-	}
-	case BT_Extend: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( asciiRanges ) );
+	case BT_Extend:
 		/* Ascii extended characters. This is the full byte range. Dependent
-		 * on signed, vs no signed. If the alphabet is one byte then just use
-		 * dot fsm. */
+		 * on signed, vs no signed. */
 		if ( isSigned )
-			retFsm = FsmAp::rangeFsm( pd->fsmCtx, -128, 127 );
+			return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( extendSignedRanges ) );
 		else
-			retFsm = FsmAp::rangeFsm( pd->fsmCtx, 0, 255 );
-		break;
-	}
-	case BT_Alpha: {
+			return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( extendUnsignedRanges ) );
+	case BT_Alpha:
 		/* Alpha [A-Za-z]. */
-		FsmAp *upper = FsmAp::rangeFsm( pd->fsmCtx, 'A', 'Z' );
-		FsmAp *lower = FsmAp::rangeFsm( pd->fsmCtx, 'a', 'z' );
-		FsmRes res = FsmAp::unionOp( upper, lower );
-		upper = res.fsm;
-		upper->minimizePartition2();
-		retFsm = upper;
-		break;
-	}
-	case BT_Digit: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( alphaRanges ) );
+	case BT_Digit:
 		/* Digits [0-9]. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, '0', '9' );
-		break;
-	}
-	case BT_Alnum: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( digitRanges ) );
+	case BT_Alnum:
 		/* Alpha numerics [0-9A-Za-z]. */
-		FsmAp *digit = FsmAp::rangeFsm( pd->fsmCtx, '0', '9' );
-		FsmAp *upper = FsmAp::rangeFsm( pd->fsmCtx, 'A', 'Z' );
-		FsmAp *lower = FsmAp::rangeFsm( pd->fsmCtx, 'a', 'z' );
-		FsmRes res1 = FsmAp::unionOp( digit, upper );
-		digit = res1.fsm;
-		FsmRes res2 = FsmAp::unionOp( digit, lower );
-		digit = res2.fsm;
-		digit->minimizePartition2();
-		retFsm = digit;
-		break;
-	}
-	case BT_Lower: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( alnumRanges ) );
+	case BT_Lower:
 		/* Lower case characters. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, 'a', 'z' );
-		break;
-	}
-	case BT_Upper: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( lowerRanges ) );
+	case BT_Upper:
 		/* Upper case characters. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, 'A', 'Z' );
-		break;
-	}
-	case BT_Cntrl: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( upperRanges ) );
+	case BT_Cntrl:
 		/* Control characters. */
-		FsmAp *cntrl = FsmAp::rangeFsm( pd->fsmCtx, 0, 31 );
-		FsmAp *highChar = FsmAp::concatFsm( pd->fsmCtx, 127 );
-		FsmRes res = FsmAp::unionOp( cntrl, highChar );
-		cntrl = res.fsm;
-		cntrl->minimizePartition2();
-		retFsm = cntrl;
-		break;
-	}
-	case BT_Graph: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( cntrlRanges ) );
+	case BT_Graph:
 		/* Graphical ascii characters [!-~]. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, '!', '~' );
-		break;
-	}
-	case BT_Print: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( graphRanges ) );
+	case BT_Print:
 		/* Printable characters. Same as graph except includes space. */
-		retFsm = FsmAp::rangeFsm( pd->fsmCtx, ' ', '~' );
-		break;
-	}
-	case BT_Punct: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( printRanges ) );
+	case BT_Punct:
 		/* Punctuation. */
-		FsmAp *range1 = FsmAp::rangeFsm( pd->fsmCtx, '!', '/' );
-		FsmAp *range2 = FsmAp::rangeFsm( pd->fsmCtx, ':', '@' );
-		FsmAp *range3 = FsmAp::rangeFsm( pd->fsmCtx, '[', '`' );
-		FsmAp *range4 = FsmAp::rangeFsm( pd->fsmCtx, '{', '~' );
-
-		FsmRes res1 = FsmAp::unionOp( range1, range2 );
-		range1 = res1.fsm;
-		FsmRes res2 = FsmAp::unionOp( range1, range3 );
-		range1 = res2.fsm;
-		FsmRes res3 = FsmAp::unionOp( range1, range4 );
-		range1 = res3.fsm;
-		range1->minimizePartition2();
-		retFsm = range1;
-		break;
-	}
-	case BT_Space: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( punctRanges ) );
+	case BT_Space:
 		/* Whitespace: [\t\v\f\n\r ]. */
-		FsmAp *cntrl = FsmAp::rangeFsm( pd->fsmCtx, '\t', '\r' );
-		FsmAp *space = FsmAp::concatFsm( pd->fsmCtx, ' ' );
-		FsmRes res = FsmAp::unionOp( cntrl, space );
-		cntrl = res.fsm;
-		cntrl->minimizePartition2();
-		retFsm = cntrl;
-		break;
-	}
-	case BT_Xdigit: {
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( spaceRanges ) );
+	case BT_Xdigit:
 		/* Hex digits [0-9A-Fa-f]. */
-		FsmAp *digit = FsmAp::rangeFsm( pd->fsmCtx, '0', '9' );
-		FsmAp *upper = FsmAp::rangeFsm( pd->fsmCtx, 'A', 'F' );
-		FsmAp *lower = FsmAp::rangeFsm( pd->fsmCtx, 'a', 'f' );
+		return builtinRangesFsm( fsmCtx, BUILTIN_RANGES( xdigitRanges ) );
+	case BT_Lambda:
+		return FsmAp::lambdaFsm( fsmCtx );
+	case BT_Empty:
+		return FsmAp::emptyFsm( fsmCtx );
+	}
 
-		FsmRes res1 = FsmAp::unionOp( digit, upper );
-		digit = res1.fsm;
-		FsmRes res2 = FsmAp::unionOp( digit, lower );
-		digit = res2.fsm;
+	return 0;
+}
 
-		digit->minimizePartition2();
-		retFsm = digit;
-		break;
-	}
-	case BT_Lambda: {
-		retFsm = FsmAp::lambdaFsm( pd->fsmCtx );
-		break;
-	}
-	case BT_Empty: {
-		retFsm = FsmAp::emptyFsm( pd->fsmCtx );
-		break;
-	}}
+/* Builtins are made once per section, after the alphabet is known, and
+ * every reference gets a copy. */
+FsmAp *makeBuiltin( BuiltinMachine builtin, ParseData *pd )
+{
+	if ( pd->builtinFsms[builtin] == 0 )
+		pd->builtinFsms[builtin] = makeBuiltinFsm( builtin, pd );
 
-	return retFsm;
+	return new FsmAp( *pd->builtinFsms[builtin] );
 }
 
 /* Check if this name inst or any name inst below is referenced. */
@@ -441,10 +769,16 @@ ParseData::ParseData( InputData *id, string sectionName,
 	nextEpsilonResolvedLink(0),
 	nextLongestMatchId(1),
 	nextRepId(1),
-	cgd(0)
+	cgd(0),
+	holdReports(false),
+	sectionErrors(0),
+	nfaFallbackExpr(0)
 {
 	fsmCtx = new FsmCtx( id );
 
+	for ( int b = 0; b < NUM_BUILTINS; b++ )
+		builtinFsms[b] = 0;
+
 	/* Initialize the dictionary of graphs. This is our symbol table. The
 	 * initialization needs to be done on construction which happens at the
 	 * beginning of a machine spec so any assignment operators can reference
@@ -457,6 +791,7 @@ ParseData::ParseData( InputData *id, string sectionName,
 ParseData::~ParseData()
 {
 	graphDict.empty();
+	graphIndex.empty();
 	fsmCtx->actionList.empty();
 
 	if ( fsmCtx->nameIndex != 0 )
@@ -467,11 +802,117 @@ ParseData::~ParseData()
 	if ( exportsRootName != 0 )
 		delete exportsRootName;
 
+	for ( Vector<LibMachine*>::Iter le = libExports; le.lte(); le++ )
+		delete *le;
+
+	clearBuiltins();
+
+	for ( Vector<SectionReport*>::Iter r = reports; r.lte(); r++ )
+		delete *r;
+
 	delete fsmCtx;
 }
 
+std::ostream &ParseData::holdReport( SectionReport::Type type, const InputLoc &loc )
+{
+	SectionReport *report = new SectionReport( type, loc );
+	reports.append( report );
+	return report->text;
+}
+
+std::ostream &ParseData::error( const InputLoc &loc )
+{
+	sectionErrors += 1;
+	if ( holdReports )
+		return holdReport( SectionReport::Error, loc );
+	return id->error( loc );
+}
+
+/* An error that belongs to no place in the input. */
+std::ostream &ParseData::error()
+{
+	sectionErrors += 1;
+	if ( holdReports )
+		return holdReport( SectionReport::Error, InputLoc() );
+	return id->error();
+}
+
+std::ostream &ParseData::warning( const InputLoc &loc )
+{
+	if ( holdReports )
+		return holdReport( SectionReport::Warning, loc );
+	return id->warning( loc );
+}
+
+std::ostream &ParseData::stats()
+{
+	if ( holdReports )
+		return holdReport( SectionReport::Stats, InputLoc() );
+	return id->stats();
+}
+
+/* Pass the held reports on to the input data, in the order they were made.
+ * Errors are counted there as they go through. */
+void ParseData::flushReports()
+{
+	for ( Vector<SectionReport*>::Iter r = reports; r.lte(); r++ ) {
+		SectionReport *report = *r;
+		switch ( report->type ) {
+			case SectionReport::Error:
+				if ( report->loc.fileName != 0 )
+					id->error( report->loc ) << report->text.str() << std::flush;
+				else
+					id->error() << report->text.str() << std::flush;
+				break;
+			case SectionReport::Warning:
+				id->warning( report->loc ) << report->text.str() << std::flush;
+				break;
+			case SectionReport::Stats:
+				id->stats() << report->text.str() << std::flush;
+				break;
+		}
+		delete report;
+	}
+	reports.empty();
+}
+
+bool fileModTime( const char *path, time_t &mtime )
+{
+	struct stat st;
+	if ( stat( path, &st ) != 0 )
+		return false;
+	mtime = st.st_mtime;
+	return true;
+}
+
 ifstream *InputData::tryOpenInclude( const char **pathChecks, long &found )
 {
+	/* The cache is keyed on the paths tried, so equal requests hit whether or
+	 * not they share the array. */
+	std::string key;
+	long numChecks = 0;
+	for ( const char **check = pathChecks; *check != 0; check++, numChecks++ )
+		key.append( *check ).append( 1, '\n' );
+
+	/* If these checks found a file before and it has not changed since, open
+	 * it directly. */
+	std::map<std::string, IncludeLocation>::iterator loc = includeLocations.find( key );
+	if ( loc != includeLocations.end() ) {
+		const IncludeLocation &location = loc->second;
+		time_t mtime;
+		if ( location.found < numChecks && location.path == pathChecks[location.found] &&
+				fileModTime( location.path.c_str(), mtime ) && mtime == location.mtime )
+		{
+			ifstream *inFile = new ifstream( location.path.c_str() );
+			if ( inFile->is_open() ) {
+				found = location.found;
+				return inFile;
+			}
+			delete inFile;
+		}
+		includeLocations.erase( loc );
+	}
+
 	const char **check = pathChecks;
 	ifstream *inFile = new ifstream;
 	
@@ -479,6 +920,13 @@ ifstream *InputData::tryOpenInclude( const char **pathChecks, long &found )
 		inFile->open( *check );
 		if ( inFile->is_open() ) {
 			found = check - pathChecks;
+
+			IncludeLocation location;
+			location.found = found;
+			location.path = *check;
+			if ( fileModTime( *check, location.mtime ) )
+				includeLocations[key] = location;
+
 			return inFile;
 		}
 
@@ -515,24 +963,37 @@ bool isAbsolutePath( const char *path )
 #endif
 
 
+/* The checks are cached and owned by the input data, so they can be kept
+ * after the include is done with them. */
 const char **InputData::makeIncludePathChecks( const char *thisFileName, const char *data )
 {
+	std::string key = std::string( thisFileName ) + '\n' + data;
+	std::map<std::string, const char**>::iterator cached = includeChecks.find( key );
+	if ( cached != includeChecks.end() )
+		return cached->second;
+
 	const char **checks = 0;
 	long nextCheck = 0;
 	int length = strlen(data);
 
 	/* Absolute path? */
 	if ( isAbsolutePath( data ) ) {
+		char *check = new char[length+1];
+		memcpy( check, data, length+1 );
+
 		checks = new const char*[2];
-		checks[nextCheck++] = data;
+		checks[nextCheck++] = check;
 	}
 	else {
 		checks = new const char*[2 + includePaths.length()];
 
 		/* Search from the the location of the current file. */
 		const char *lastSlash = strrchr( thisFileName, PATH_SEP );
-		if ( lastSlash == 0 )
-			checks[nextCheck++] = data;
+		if ( lastSlash == 0 ) {
+			char *check = new char[length+1];
+			memcpy( check, data, length+1 );
+			checks[nextCheck++] = check;
+		}
 		else {
 			long givenPathLen = (lastSlash - thisFileName) + 1;
 			long checklen = givenPathLen + length;
@@ -557,9 +1018,70 @@ const char **InputData::makeIncludePathChecks( const char *thisFileName, const c
 	}
 
 	checks[nextCheck] = 0;
+	includeChecks[key] = checks;
 	return checks;
 }
 
+/* Checks for including from the current file itself, cached the same way.
+ * File names are never empty, so the key can't clash with the ones above. */
+const char **InputData::makeFileChecks( const char *fileName )
+{
+	std::string key = std::string( 1, '\n' ) + fileName;
+	std::map<std::string, const char**>::iterator cached = includeChecks.find( key );
+	if ( cached != includeChecks.end() )
+		return cached->second;
+
+	char *check = new char[strlen(fileName)+1];
+	strcpy( check, fileName );
+
+	const char **checks = new const char*[2];
+	checks[0] = check;
+	checks[1] = 0;
+
+	includeChecks[key] = checks;
+	return checks;
+}
+
+void ImportResult::append( int type, const char *start, const char *end )
+{
+	Token token;
+	token.type = type;
+	token.hasData = start != 0;
+	if ( start != 0 )
+		token.data.assign( start, end - start );
+	tokens.push_back( token );
+}
+
+/* A previous scan of an import file, if the file has not changed since. */
+ImportResult *InputData::findImport( const char *path )
+{
+	std::map<std::string, ImportResult>::iterator ir = importResults.find( path );
+	if ( ir == importResults.end() )
+		return 0;
+
+	time_t mtime;
+	if ( !fileModTime( path, mtime ) || mtime != ir->second.mtime ) {
+		importResults.erase( ir );
+		return 0;
+	}
+
+	return &ir->second;
+}
+
+/* Start recording the scan of an import file. Returns nil if the file can't
+ * be dated, in which case it is not cached. */
+ImportResult *InputData::newImport( const char *path )
+{
+	time_t mtime;
+	if ( !fileModTime( path, mtime ) )
+		return 0;
+
+	ImportResult &ir = importResults[path];
+	ir.mtime = mtime;
+	ir.tokens.clear();
+	return &ir;
+}
+
 
 /* An approximate check for duplicate includes. Due to aliasing of files it's
  * possible for duplicates to creep in. */
@@ -584,10 +1106,10 @@ NameInst *ParseData::addNameInst( const InputLoc &loc, std::string data, bool is
 	NameInst *newNameInst = new NameInst( loc, curNameInst, data, nextNameId++, isLabel );
 	curNameInst->childVect.append( newNameInst );
 	if ( !data.empty() ) {
-		NameMapEl *inDict = 0;
-		if ( curNameInst->children.insert( data, &inDict ) )
-			inDict->value = new NameMapVal;
-		inDict->value->vals.append( newNameInst );
+		int sym = id->symbols.intern( data );
+		while ( nameIndex.length() <= sym )
+			nameIndex.append( NameVect() );
+		nameIndex[sym].append( newNameInst );
 	}
 	return newNameInst;
 }
@@ -648,6 +1170,51 @@ void ParseData::resetNameScope( const NameFrame &frame )
 	localNameScope = frame.prevLocalScope;
 }
 
+WalkFrame ParseData::saveWalk()
+{
+	WalkFrame frame;
+	frame.nameFrame.prevNameInst = curNameInst;
+	frame.nameFrame.prevNameChild = curNameChild;
+	frame.nameFrame.prevLocalScope = localNameScope;
+	frame.nextEpsilonResolvedLink = nextEpsilonResolvedLink;
+	frame.numCuts = cuts.length();
+	frame.curActionOrd = fsmCtx->curActionOrd;
+	frame.curPriorOrd = fsmCtx->curPriorOrd;
+	return frame;
+}
+
+/* Rewind the walk so the parse tree below the point where the frame was saved
+ * can be walked again, in sync with the name tree. */
+void ParseData::restoreWalk( const WalkFrame &frame )
+{
+	resetNameScope( frame.nameFrame );
+	nextEpsilonResolvedLink = frame.nextEpsilonResolvedLink;
+	cuts.remove( frame.numCuts, cuts.length() - frame.numCuts );
+	fsmCtx->curActionOrd = frame.curActionOrd;
+	fsmCtx->curPriorOrd = frame.curPriorOrd;
+}
+
+/* The union that the memory limit can turn into an NFA union: the top level
+ * of an instance, where an NFA union may appear, and only when it is not
+ * built as a literal trie. */
+Expression *ParseData::memoryFallbackUnion( VarDef *varDef )
+{
+	MachineDef *machineDef = varDef->machineDef;
+	if ( machineDef->type != MachineDef::JoinType ||
+			machineDef->join->exprList.length() != 1 )
+		return 0;
+
+	Expression *expr = machineDef->join->exprList.head;
+	if ( expr->type != Expression::OrType )
+		return 0;
+
+	Vector<Literal*> lits;
+	if ( expr->literalChain( this, lits ) )
+		return 0;
+
+	return expr;
+}
+
 
 void ParseData::unsetObsoleteEntries( FsmAp *graph )
 {
@@ -667,50 +1234,53 @@ void ParseData::unsetObsoleteEntries( FsmAp *graph )
 	}
 }
 
-NameSet ParseData::resolvePart( NameInst *refFrom,
-		const std::string &data, bool recLabelsOnly )
+/* Find the instances of a name below refFrom. Rather than search the
+ * subtree, each instance of the name is checked for refFrom among its
+ * ancestors. With recLabelsOnly the instance must be reached through labels
+ * only. */
+NameSet ParseData::resolvePart( NameInst *refFrom, int sym, bool recLabelsOnly )
 {
-	/* Queue needed for breadth-first search, load it with the start node. */
-	NameInstList nameQueue;
-	nameQueue.append( refFrom );
-
 	NameSet result;
-	while ( nameQueue.length() > 0 ) {
-		/* Pull the next from location off the queue. */
-		NameInst *from = nameQueue.detachFirst();
-
-		/* Look for the name. */
-		NameMapEl *el = from->children.find( data );
-		if ( el != 0 ) {
-			/* Record all instances of the name. */
-			for ( Vector<NameInst*>::Iter low = el->value->vals; low.lte(); low++ )
-				result.insert( *low );
+	if ( sym < 0 || sym >= nameIndex.length() )
+		return result;
+
+	for ( NameVect::Iter inst = nameIndex[sym]; inst.lte(); inst++ ) {
+		NameInst *parent = (*inst)->parent;
+		while ( parent != 0 && parent != refFrom ) {
+			if ( recLabelsOnly && !parent->isLabel ) {
+				parent = 0;
+				break;
+			}
+			parent = parent->parent;
 		}
 
-		/* Name not there, do breadth-first operation of appending all
-		 * childrent to the processing queue. */
-		for ( NameVect::Iter name = from->childVect; name.lte(); name++ ) {
-			if ( !recLabelsOnly || (*name)->isLabel )
-				nameQueue.append( *name );
-		}
+		if ( parent == refFrom )
+			result.insert( *inst );
 	}
 
-	/* Queue exhausted and name never found. */
 	return result;
 }
 
+/* The symbols of the parts of a name reference, -1 for a part never seen in
+ * a name tree. Found once for all the scopes it is resolved from. */
+void ParseData::nameRefSymbols( Vector<int> &syms, NameRef *nameRef )
+{
+	for ( int p = 0; p < nameRef->length(); p++ )
+		syms.append( id->symbols.find( nameRef->data[p] ) );
+}
+
 void ParseData::resolveFrom( NameSet &result, NameInst *refFrom, 
-		NameRef *nameRef, int namePos )
+		const Vector<int> &syms, int namePos )
 {
 	/* Look for the name in the owning scope of the factor with aug. */
-	NameSet partResult = resolvePart( refFrom, nameRef->data[namePos], false );
+	NameSet partResult = resolvePart( refFrom, syms[namePos], false );
 	
 	/* If there are more parts to the name then continue on. */
-	if ( ++namePos < nameRef->length() ) {
+	if ( ++namePos < syms.length() ) {
 		/* There are more components to the name, search using all the part
 		 * results as the base. */
 		for ( NameSet::Iter name = partResult; name.lte(); name++ )
-			resolveFrom( result, *name, nameRef, namePos );
+			resolveFrom( result, *name, syms, namePos );
 	}
 	else {
 		/* This is the last component, append the part results to the final
@@ -782,7 +1352,7 @@ void ParseData::errorStateLabels( const NameSet &resolved )
 	MergeSort<NameInst*, CmpNameInstLoc> mergeSort;
 	mergeSort.sort( resolved.data, resolved.length() );
 	for ( NameSet::Iter res = resolved; res.lte(); res++ )
-		id->error((*res)->loc) << "  -> " << **res << endl;
+		error((*res)->loc) << "  -> " << **res << endl;
 }
 
 
@@ -790,6 +1360,9 @@ NameInst *ParseData::resolveStateRef( NameRef *nameRef, InputLoc &loc, Action *a
 {
 	NameInst *nameInst = 0;
 
+	Vector<int> syms;
+	nameRefSymbols( syms, nameRef );
+
 	/* Do the local search if the name is not strictly a root level name
 	 * search. */
 	if ( nameRef->data[0] != "" ) {
@@ -798,14 +1371,14 @@ NameInst *ParseData::resolveStateRef( NameRef *nameRef, InputLoc &loc, Action *a
 			/* Look for the name in all referencing scopes. */
 			NameSet resolved;
 			for ( NameInstVect::Iter actRef = action->embedRoots; actRef.lte(); actRef++ )
-				resolveFrom( resolved, *actRef, nameRef, 0 );
+				resolveFrom( resolved, *actRef, syms, 0 );
 
 			if ( resolved.length() > 0 ) {
 				/* Take the first one. */
 				nameInst = resolved[0];
 				if ( resolved.length() > 1 ) {
 					/* Complain about the multiple references. */
-					id->error(loc) << "state reference " << *nameRef << 
+					error(loc) << "state reference " << *nameRef << 
 							" resolves to multiple entry points" << endl;
 					errorStateLabels( resolved );
 				}
@@ -817,14 +1390,14 @@ NameInst *ParseData::resolveStateRef( NameRef *nameRef, InputLoc &loc, Action *a
 	if ( nameInst == 0 ) {
 		NameSet resolved;
 		int fromPos = nameRef->data[0] != "" ? 0 : 1;
-		resolveFrom( resolved, rootName, nameRef, fromPos );
+		resolveFrom( resolved, rootName, syms, fromPos );
 
 		if ( resolved.length() > 0 ) {
 			/* Take the first. */
 			nameInst = resolved[0];
 			if ( resolved.length() > 1 ) {
 				/* Complain about the multiple references. */
-				id->error(loc) << "state reference " << *nameRef << 
+				error(loc) << "state reference " << *nameRef << 
 						" resolves to multiple entry points" << endl;
 				errorStateLabels( resolved );
 			}
@@ -833,7 +1406,7 @@ NameInst *ParseData::resolveStateRef( NameRef *nameRef, InputLoc &loc, Action *a
 
 	if ( nameInst == 0 ) {
 		/* If not found then complain. */
-		id->error(loc) << "could not resolve state reference " << *nameRef << endl;
+		error(loc) << "could not resolve state reference " << *nameRef << endl;
 	}
 	return nameInst;
 }
@@ -854,7 +1427,7 @@ void ParseData::resolveNameRefs( InlineList *inlineList, Action *action )
 					NameInst *search = target->parent;
 					while ( search != 0 ) {
 						if ( search->isLongestMatch ) {
-							id->error(item->loc) << "cannot enter inside a longest "
+							error(item->loc) << "cannot enter inside a longest "
 									"match construction as an entry point" << endl;
 							break;
 						}
@@ -938,12 +1511,61 @@ void ParseData::makeNameTree( GraphDictEl *dictEl )
 
 void ParseData::createBuiltin( const char *name, BuiltinMachine builtin )
 {
-	Expression *expression = new Expression( builtin );
-	Join *join = new Join( expression );
-	MachineDef *machineDef = new MachineDef( join );
-	VarDef *varDef = new VarDef( name, machineDef );
+	Expression *expression = new (arena) Expression( builtin );
+	Join *join = new (arena) Join( expression );
+	MachineDef *machineDef = new (arena) MachineDef( join );
+	VarDef *varDef = new (arena) VarDef( name, machineDef );
 	GraphDictEl *graphDictEl = new GraphDictEl( name, varDef );
+	insertGraph( graphDictEl );
+}
+
+/* Make a machine loaded from a library available by name. The parse tree is
+ * only the chain down to a factor that holds the ready graph. */
+void ParseData::createLibMachine( LibMachine *libMachine )
+{
+	/* Builtins take precedence. */
+	if ( findGraph( libMachine->name ) != 0 )
+		return;
+
+	Factor *factor = new (arena) Factor( InputLoc(), libMachine );
+	FactorWithNeg *factorWithNeg = new (arena) FactorWithNeg( factor );
+	FactorWithRep *factorWithRep = new (arena) FactorWithRep( factorWithNeg );
+	FactorWithAug *factorWithAug = new (arena) FactorWithAug( factorWithRep );
+	Term *term = new (arena) Term( factorWithAug );
+	Expression *expression = new (arena) Expression( term );
+	Join *join = new (arena) Join( expression );
+	MachineDef *machineDef = new (arena) MachineDef( join );
+	VarDef *varDef = new (arena) VarDef( libMachine->name, machineDef );
+	GraphDictEl *graphDictEl = new GraphDictEl( libMachine->name, varDef );
+	insertGraph( graphDictEl );
+}
+
+GraphDictEl *ParseData::findGraph( const std::string &name )
+{
+	int sym = id->symbols.find( name );
+	return sym >= 0 && sym < graphIndex.length() ? graphIndex[sym] : 0;
+}
+
+/* Add a graph to the dict and the index. Returns the new element, or zero if
+ * the name is already defined. */
+GraphDictEl *ParseData::insertGraph( const std::string &name )
+{
+	if ( findGraph( name ) != 0 )
+		return 0;
+
+	GraphDictEl *graphDictEl = new GraphDictEl( name );
+	insertGraph( graphDictEl );
+	return graphDictEl;
+}
+
+void ParseData::insertGraph( GraphDictEl *graphDictEl )
+{
 	graphDict.insert( graphDictEl );
+
+	int sym = id->symbols.intern( graphDictEl->key );
+	while ( graphIndex.length() <= sym )
+		graphIndex.append( 0 );
+	graphIndex[sym] = graphDictEl;
 }
 
 /* Initialize the graph dict with builtin types. */
@@ -966,6 +1588,10 @@ void ParseData::initGraphDict( )
 	createBuiltin( "null", BT_Lambda );
 	createBuiltin( "zlen", BT_Lambda );
 	createBuiltin( "empty", BT_Empty );
+
+	/* Machines from precompiled libraries. */
+	for ( Vector<LibMachine*>::Iter lm = id->libMachines; lm.lte(); lm++ )
+		createLibMachine( *lm );
 }
 
 /* Set the alphabet type. If the types are not valid returns false. */
@@ -1016,6 +1642,43 @@ bool ParseData::setVariable( const char *var, InlineList *inlineList )
 	return set;
 }
 
+static void snapshotUses( SnapshotLayout &layout, InlineList *inlineList )
+{
+	for ( InlineList::Iter item = *inlineList; item.lte(); item++ ) {
+		switch ( item->type ) {
+			case InlineItem::Call: case InlineItem::CallExpr:
+			case InlineItem::Ncall: case InlineItem::NcallExpr:
+			case InlineItem::Ret: case InlineItem::Nret:
+				layout.stack = true;
+				break;
+			case InlineItem::LmSetActId: case InlineItem::LmSwitch:
+				layout.act = true;
+				break;
+			default:
+				break;
+		}
+
+		if ( item->children != 0 )
+			snapshotUses( layout, item->children );
+	}
+}
+
+/* Find what a snapshot of the machine must hold by looking through the
+ * actions. */
+void ParseData::snapshotLayout( SnapshotLayout &layout )
+{
+	for ( ActionList::Iter act = fsmCtx->actionList; act.lte(); act++ )
+		snapshotUses( layout, act->inlineList );
+
+	layout.tokens = lmList.length() > 0;
+	for ( LmList::Iter lm = lmList; lm.lte(); lm++ ) {
+		for ( LmPartList::Iter lmi = *lm->longestMatchList; lmi.lte(); lmi++ ) {
+			if ( lmi->longestMatchId > layout.maxActId )
+				layout.maxActId = lmi->longestMatchId;
+		}
+	}
+}
+
 /* Initialize the key operators object that will be referenced by all fsms
  * created. */
 void ParseData::initKeyOps( const HostLang *hostLang )
@@ -1162,27 +1825,299 @@ void ParseData::longestMatchInitTweaks( FsmAp *graph )
 	}
 }
 
-/* Always returns the breadth check result. Will not consume the fsm. */
-BreadthResult *ParseData::checkBreadth( FsmAp *fsm )
+/* Histograms are indexed from minKey. Alphabets larger than this are
+ * rejected rather than allocating for every key. */
+#define HISTOGRAM_MAX_KEYS ( 1L << 20 )
+
+/* Make the input histogram for a breadth check starting at entry, sized for
+ * the alphabet of this machine. Caller frees. Reports an error and returns
+ * zero if the alphabet can't have one. */
+double *ParseData::makeHistogram( FsmAp *fsm, StateAp *entry )
 {
-	double start = 0;
-	int minDepth = 0;
-	FsmAp::breadthFromEntry( start, minDepth, id->histogram, fsm, fsm->startState );
+	KeyOps *keyOps = fsmCtx->keyOps;
+	unsigned long minVal = (unsigned long)keyOps->minKey.getVal();
+	unsigned long alphSize = (unsigned long)keyOps->maxKey.getVal() - minVal + 1;
+	if ( alphSize == 0 || alphSize > (unsigned long)HISTOGRAM_MAX_KEYS ) {
+		error() << "breadth check: alphabet type is too wide for "
+				"an input histogram" << endl;
+		return 0;
+	}
 
-	BreadthResult *breadth = new BreadthResult( start );
-	
-	for ( Vector<ParseData::Cut>::Iter c = cuts; c.lte(); c++ ) {
-		for ( EntryMap::Iter mel = fsm->entryPoints; mel.lte(); mel++ ) {
-			if ( mel->key == c->entryId ) {
-				double cost = 0;
-				int minDepth = 0;
-				FsmAp::breadthFromEntry( cost, minDepth, id->histogram, fsm, mel->value );
-
-				breadth->costs.append( BreadthCost( c->name, cost ) );
+	if ( id->histogramValues.length() > 0 &&
+			(unsigned long)id->histogramValues.length() != alphSize )
+	{
+		error() << "histogram read: " << id->histogramValues.length() <<
+				" values given, expecting " << alphSize <<
+				" (for the alphabet type)" << endl;
+		return 0;
+	}
+
+	double *histogram = new double[alphSize];
+
+	if ( id->histogramValues.length() > 0 ) {
+		for ( unsigned long i = 0; i < alphSize; i++ )
+			histogram[i] = id->histogramValues[i];
+		return histogram;
+	}
+
+	if ( id->corpusCounts == 0 ) {
+		/* Flat histogram. */
+		for ( unsigned long i = 0; i < alphSize; i++ )
+			histogram[i] = 1.0 / (double)alphSize;
+		return histogram;
+	}
+
+	/* Histogram position and key of each corpus byte, as makeFsmKeyArray
+	 * would convert it. */
+	unsigned long pos[256];
+	Key keys[256];
+	for ( int b = 0; b < 256; b++ ) {
+		keys[b] = keyOps->isSigned ? Key( (char)b ) : Key( (unsigned char)b );
+		pos[b] = (unsigned long)keys[b].getVal() - minVal;
+	}
+
+	const double *counts = id->corpusCounts;
+	double *conditioned = 0;
+
+	if ( id->corpusPairs != 0 && entry != fsm->startState ) {
+		/* First order. Find the bytes that can lead into the entry point and
+		 * sum the counts of the bytes that follow them. */
+		bool leadsIn[256];
+		memset( leadsIn, 0, sizeof(leadsIn) );
+		for ( StateList::Iter st = fsm->stateList; st.lte(); st++ ) {
+			for ( TransList::Iter trans = st->outList; trans.lte(); trans++ ) {
+				bool toEntry = false;
+				if ( trans->plain() )
+					toEntry = trans->tdap()->toState == entry;
+				else {
+					for ( CondList::Iter cond = trans->tcap()->condList; cond.lte(); cond++ ) {
+						if ( cond->toState == entry )
+							toEntry = true;
+					}
+				}
+
+				if ( toEntry ) {
+					for ( int b = 0; b < 256; b++ ) {
+						if ( keyOps->le( trans->lowKey, keys[b] ) &&
+								keyOps->le( keys[b], trans->highKey ) )
+							leadsIn[b] = true;
+					}
+				}
 			}
 		}
+
+		conditioned = new double[256];
+		double total = 0;
+		for ( int cur = 0; cur < 256; cur++ ) {
+			conditioned[cur] = 0;
+			for ( int prev = 0; prev < 256; prev++ ) {
+				if ( leadsIn[prev] )
+					conditioned[cur] += id->corpusPairs[prev * 256 + cur];
+			}
+			total += conditioned[cur];
+		}
+
+		/* Nothing in the corpus follows those bytes. Fall back to the byte
+		 * frequencies. */
+		if ( total > 0 )
+			counts = conditioned;
+	}
+
+	double total = 0;
+	for ( int b = 0; b < 256; b++ )
+		total += counts[b];
+
+	memset( histogram, 0, sizeof(double) * alphSize );
+	for ( int b = 0; b < 256; b++ ) {
+		if ( pos[b] < alphSize )
+			histogram[pos[b]] += counts[b] / total;
+	}
+
+	delete[] conditioned;
+	return histogram;
+}
+
+/* One distinct state to compute the breadth cost from. Cuts that share an
+ * entry state share the job. */
+struct BreadthJob
+{
+	StateAp *state;
+	long position;
+	double *histogram;
+	double cost;
+};
+
+/* Each worker walks its own copy of the machine, since the breadth walk
+ * marks states as it goes. */
+struct BreadthWorker
+{
+	FsmAp *fsm;
+	Vector<StateAp*> states;
+
+	BreadthJob *jobs;
+	long numJobs;
+	long *nextJob;
+#ifndef _WIN32
+	pthread_mutex_t *mutex;
+#endif
+};
+
+static void *breadthWork( void *arg )
+{
+	BreadthWorker *worker = (BreadthWorker*)arg;
+	while ( true ) {
+#ifndef _WIN32
+		pthread_mutex_lock( worker->mutex );
+#endif
+		long j = (*worker->nextJob)++;
+#ifndef _WIN32
+		pthread_mutex_unlock( worker->mutex );
+#endif
+		if ( j >= worker->numJobs )
+			break;
+
+		BreadthJob *job = worker->jobs + j;
+		int minDepth = 0;
+		job->cost = 0;
+		FsmAp::breadthFromEntry( job->cost, minDepth, job->histogram,
+				worker->fsm, worker->states[job->position] );
+	}
+	return 0;
+}
+
+/* Each breadth worker past the first holds a copy of the machine, so the
+ * count is kept small. */
+#define BREADTH_MAX_WORKERS 8
+
+/* Returns the breadth check result, or zero if the input histogram could not
+ * be made. Will not consume the fsm. */
+BreadthResult *ParseData::checkBreadth( FsmAp *fsm )
+{
+	/* Position of each state in the state list. Copies of the machine keep
+	 * the order, so a position identifies the state in every copy. */
+	Vector<StateAp*> states;
+	AvlMap<StateAp*, long> positions;
+	for ( StateList::Iter st = fsm->stateList; st.lte(); st++ ) {
+		positions.insert( st, states.length() );
+		states.append( st );
+	}
+
+	/* Collect the distinct entry states, starting with the start state. */
+	Vector<BreadthJob> jobs;
+	AvlMap<StateAp*, long> jobOf;
+	Vector<long> cutJobs;
+	Vector<long> cutOf;
+
+	BreadthJob startJob = { fsm->startState, positions.find( fsm->startState )->value, 0, 0 };
+	jobs.append( startJob );
+	jobOf.insert( fsm->startState, 0 );
+
+	for ( long c = 0; c < cuts.length(); c++ ) {
+		EntryMapEl *low = 0, *high = 0;
+		if ( !fsm->entryPoints.findMulti( cuts[c].entryId, low, high ) )
+			continue;
+
+		for ( EntryMapEl *mel = low; mel <= high; mel++ ) {
+			AvlMapEl<StateAp*, long> *job = jobOf.find( mel->value );
+			if ( job == 0 ) {
+				BreadthJob entryJob = { mel->value, positions.find( mel->value )->value, 0, 0 };
+				job = jobOf.insert( mel->value, jobs.length() );
+				jobs.append( entryJob );
+			}
+			cutJobs.append( job->value );
+			cutOf.append( c );
+		}
+	}
+
+	/* Histograms are computed up front, they read the shared machine. The
+	 * reasons one can't be made don't depend on the entry. */
+	for ( long j = 0; j < jobs.length(); j++ ) {
+		jobs[j].histogram = makeHistogram( fsm, jobs[j].state );
+		if ( jobs[j].histogram == 0 ) {
+			for ( long k = 0; k < j; k++ )
+				delete[] jobs[k].histogram;
+			return 0;
+		}
+	}
+
+	long numWorkers = id->breadthJobs;
+#ifdef _WIN32
+	numWorkers = 1;
+#else
+	if ( numWorkers <= 0 )
+		numWorkers = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+	if ( numWorkers > BREADTH_MAX_WORKERS )
+		numWorkers = BREADTH_MAX_WORKERS;
+
+	/* Already on a codegen worker, don't start more threads. */
+	if ( holdReports )
+		numWorkers = 1;
+	if ( numWorkers > jobs.length() )
+		numWorkers = jobs.length();
+	if ( numWorkers < 1 )
+		numWorkers = 1;
+
+	long nextJob = 0;
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+	pthread_mutex_init( &mutex, 0 );
+#endif
+
+	BreadthWorker *workers = new BreadthWorker[numWorkers];
+	for ( long w = 0; w < numWorkers; w++ ) {
+		/* The first worker runs on this thread and walks the machine itself,
+		 * as the serial check did. Copies are made before any thread starts. */
+		if ( w == 0 ) {
+			workers[w].fsm = fsm;
+			workers[w].states = states;
+		}
+		else {
+			workers[w].fsm = new FsmAp( *fsm );
+			for ( StateList::Iter st = workers[w].fsm->stateList; st.lte(); st++ )
+				workers[w].states.append( st );
+		}
+
+		workers[w].jobs = jobs.data;
+		workers[w].numJobs = jobs.length();
+		workers[w].nextJob = &nextJob;
+#ifndef _WIN32
+		workers[w].mutex = &mutex;
+#endif
+	}
+
+#ifndef _WIN32
+	pthread_t *threads = new pthread_t[numWorkers];
+	long started = 1;
+	for ( ; started < numWorkers; started++ ) {
+		if ( pthread_create( &threads[started], 0, breadthWork, &workers[started] ) != 0 )
+			break;
+	}
+	breadthWork( &workers[0] );
+	for ( long w = 1; w < started; w++ )
+		pthread_join( threads[w], 0 );
+	delete[] threads;
+	pthread_mutex_destroy( &mutex );
+#else
+	breadthWork( &workers[0] );
+#endif
+
+	if ( id->printStatistics ) {
+		stats() << "breadth entries\t" << jobs.length() << endl;
+		stats() << "breadth workers\t" << numWorkers << endl;
 	}
 
+	for ( long w = 1; w < numWorkers; w++ )
+		delete workers[w].fsm;
+	delete[] workers;
+
+	BreadthResult *breadth = new BreadthResult( jobs[0].cost );
+	for ( long i = 0; i < cutJobs.length(); i++ )
+		breadth->costs.append( BreadthCost( cuts[cutOf[i]].name, jobs[cutJobs[i]].cost ) );
+
+	for ( long j = 0; j < jobs.length(); j++ )
+		delete[] jobs[j].histogram;
+
 	return breadth;
 }
 
@@ -1235,14 +2170,45 @@ void ParseData::reportAnalysisResult( FsmRes &res )
 FsmRes ParseData::makeInstance( GraphDictEl *gdNode )
 {
 	if ( id->printStatistics )
-		id->stats() << "compiling\t" << sectionName << endl;
+		stats() << "compiling\t" << sectionName << endl;
 	
 	if ( id->stateLimit > 0 )
 		fsmCtx->stateLimit = id->stateLimit;
 
+	/* Under a memory limit, an instance that is a union of alternatives is
+	 * first built as a DFA with the states bounded, so a blowup is abandoned
+	 * before it completes. */
+	Expression *rootUnion = id->memoryLimit > 0 ? memoryFallbackUnion( gdNode->value ) : 0;
+	WalkFrame walkFrame;
+	if ( rootUnion != 0 ) {
+		walkFrame = saveWalk();
+		long memStates = id->memoryLimit / sizeof(StateAp);
+		if ( id->stateLimit <= 0 || memStates < id->stateLimit )
+			fsmCtx->stateLimit = memStates;
+	}
+
 	/* Build the graph from a walk of the parse tree. */
 	FsmRes graph = gdNode->value->walk( this );
 
+	if ( rootUnion != 0 ) {
+		fsmCtx->stateLimit = id->stateLimit > 0 ? id->stateLimit :
+				FsmCtx::STATE_UNLIMITED;
+
+		/* Over the limit, rewind and build the alternatives as an NFA
+		 * union. */
+		if ( graph.type == FsmRes::TypeTooManyStates ||
+				( graph.success() && graphMemory( graph.fsm ) > id->memoryLimit ) )
+		{
+			if ( graph.success() )
+				delete graph.fsm;
+
+			restoreWalk( walkFrame );
+			nfaFallbackExpr = rootUnion;
+			graph = gdNode->value->walk( this );
+			nfaFallbackExpr = 0;
+		}
+	}
+
 	if ( id->stateLimit > 0 )
 		fsmCtx->stateLimit = FsmCtx::STATE_UNLIMITED;
 
@@ -1251,7 +2217,8 @@ FsmRes ParseData::makeInstance( GraphDictEl *gdNode )
 	 * and stop output. */
 	if ( graph.success() && id->checkBreadth ) {
 		BreadthResult *breadth = checkBreadth( graph.fsm );
-		reportBreadthResults( breadth );
+		if ( breadth != 0 )
+			reportBreadthResults( breadth );
 	}
 
 	if ( id->condsCheckDepth >= 0 ) {
@@ -1398,10 +2365,20 @@ void ParseData::makeExports()
 			/* Build the graph from a walk of the parse tree. */
 			FsmRes graph = gdel->value->walk( this );
 
-			/* Build the graph from a walk of the parse tree. */
+			if ( id->libraryOut != 0 ) {
+				/* Writing a library. The export is the whole machine, and
+				 * need not be a single character. */
+				graph.fsm->minimizePartition2();
+				LibMachine *libMachine = makeLibMachine( gdel, graph.fsm );
+				if ( libMachine != 0 )
+					libExports.append( libMachine );
+			}
+
 			if ( !graph.fsm->checkSingleCharMachine() ) {
-				id->error(gdel->loc) << "bad export machine, must define "
-						"a single character" << endl;
+				if ( id->libraryOut == 0 ) {
+					error(gdel->loc) << "bad export machine, must define "
+							"a single character" << endl;
+				}
 			}
 			else {
 				/* Safe to extract the key and declare the export. */
@@ -1412,6 +2389,280 @@ void ParseData::makeExports()
 	}
 }
 
+/* True if any state of the section's machine has nfa transitions. */
+bool ParseData::nfaStates()
+{
+	if ( sectionGraph != 0 ) {
+		for ( StateList::Iter st = sectionGraph->stateList; st.lte(); st++ ) {
+			if ( st->nfaOut != 0 )
+				return true;
+		}
+	}
+	return false;
+}
+
+/* Can the generated code skip ahead with memchr while in the start state?
+ * That is safe when the start state leaves itself on exactly one key and
+ * loops on every other key of the alphabet with no actions, and nothing fires
+ * on entering or leaving it. Single byte alphabets only. */
+bool ParseData::prefilterKey( Key &key )
+{
+	KeyOps *keyOps = fsmCtx->keyOps;
+	if ( alphType->size != 1 || sectionGraph == 0 ||
+			sectionGraph->startState == 0 )
+		return false;
+
+	StateAp *start = sectionGraph->startState;
+
+	if ( start->toStateActionTable.length() > 0 ||
+			start->fromStateActionTable.length() > 0 )
+		return false;
+
+	/* Windows of the buffer are run separately, which nfa backtracking
+	 * can't cross. */
+	if ( nfaStates() )
+		return false;
+
+	bool found = false;
+	long expect = keyOps->minKey.getVal();
+	for ( TransList::Iter trans = start->outList; trans.lte(); trans++ ) {
+		/* A gap goes to the error state. */
+		if ( trans->lowKey.getVal() != expect || !trans->plain() )
+			return false;
+
+		if ( trans->tdap()->toState == start ) {
+			if ( trans->tdap()->actionTable.length() > 0 )
+				return false;
+		}
+		else {
+			if ( found || trans->lowKey.getVal() != trans->highKey.getVal() )
+				return false;
+			found = true;
+			key = trans->lowKey;
+		}
+
+		if ( trans->highKey.getVal() == keyOps->maxKey.getVal() )
+			return found;
+
+		expect = trans->highKey.getVal() + 1;
+	}
+
+	return false;
+}
+
+/* Store an inline list in preorder. False if it has an item that can't go
+ * in a library. */
+static bool libInlineItems( std::vector<LibMachine::ItemDef> &items, InlineList *inlineList )
+{
+	for ( InlineList::Iter item = *inlineList; item.lte(); item++ ) {
+		long type = 0;
+		while ( type < numLibItemTypes && libItemTypes[type] != item->type )
+			type += 1;
+		if ( type == numLibItemTypes )
+			return false;
+
+		LibMachine::ItemDef itemDef;
+		itemDef.type = type;
+		itemDef.data = item->data;
+		itemDef.numChildren = item->children != 0 ? item->children->length() : -1;
+		items.push_back( itemDef );
+
+		if ( item->children != 0 && !libInlineItems( items, item->children ) )
+			return false;
+	}
+	return true;
+}
+
+/* Gives the actions, priorities and orderings of a machine being stored their
+ * numbers in the library. */
+struct LibEmbedMaker
+{
+	LibEmbedMaker( ParseData *pd, LibMachine *libMachine )
+		: pd(pd), libMachine(libMachine), bad(0) {}
+
+	void action( long type, long target, int ordering, Action *action );
+	void prior( long type, long target, int ordering, PriorDesc *prior );
+	void actionTable( long type, long target, ActionTable &table );
+	void priorTable( long type, long target, PriorTable &table );
+	void finish();
+
+	ParseData *pd;
+	LibMachine *libMachine;
+	std::map<Action*, long> actionIds;
+	std::map<PriorDesc*, long> priorIds;
+	std::map<int, long> actionOrds;
+	std::map<int, long> priorOrds;
+	const char *bad;
+};
+
+void LibEmbedMaker::action( long type, long target, int ordering, Action *action )
+{
+	std::map<Action*, long>::iterator id = actionIds.find( action );
+	if ( id == actionIds.end() ) {
+		LibMachine::ActionDef actionDef;
+		actionDef.name = action->name;
+		actionDef.fileName = action->loc.fileName != 0 ? action->loc.fileName : "";
+		actionDef.line = action->loc.line;
+		actionDef.col = action->loc.col;
+		if ( !libInlineItems( actionDef.items, action->inlineList ) )
+			bad = "actions that refer to states, scanners or arguments";
+
+		id = actionIds.insert( std::make_pair( action,
+				(long)libMachine->actions.size() ) ).first;
+		libMachine->actions.push_back( actionDef );
+	}
+
+	actionOrds[ordering] = 0;
+	LibMachine::Embed embed = { type, target, ordering, id->second };
+	libMachine->embeds.append( embed );
+}
+
+void LibEmbedMaker::prior( long type, long target, int ordering, PriorDesc *prior )
+{
+	if ( prior->guarded )
+		bad = "guarded priorities";
+
+	std::map<PriorDesc*, long>::iterator id = priorIds.find( prior );
+	if ( id == priorIds.end() ) {
+		LibMachine::PriorDef priorDef;
+		priorDef.key = prior->key;
+		priorDef.priority = prior->priority;
+		for ( PriorDict::Iter pde = pd->priorDict; pde.lte(); pde++ ) {
+			if ( pde->value == prior->key )
+				priorDef.name = pde->key;
+		}
+
+		id = priorIds.insert( std::make_pair( prior,
+				(long)libMachine->priors.size() ) ).first;
+		libMachine->priors.push_back( priorDef );
+	}
+
+	priorOrds[ordering] = 0;
+	LibMachine::Embed embed = { type, target, ordering, id->second };
+	libMachine->embeds.append( embed );
+}
+
+void LibEmbedMaker::actionTable( long type, long target, ActionTable &table )
+{
+	for ( ActionTable::Iter ati = table; ati.lte(); ati++ )
+		action( type, target, ati->key, ati->value );
+}
+
+void LibEmbedMaker::priorTable( long type, long target, PriorTable &table )
+{
+	for ( PriorTable::Iter pti = table; pti.lte(); pti++ )
+		prior( type, target, pti->ordering, pti->desc );
+}
+
+/* Renumber the orderings from zero, keeping their order. */
+void LibEmbedMaker::finish()
+{
+	long n = 0;
+	for ( std::map<int, long>::iterator o = actionOrds.begin(); o != actionOrds.end(); o++ )
+		o->second = n++;
+	libMachine->numActionOrds = n;
+
+	n = 0;
+	for ( std::map<int, long>::iterator o = priorOrds.begin(); o != priorOrds.end(); o++ )
+		o->second = n++;
+	libMachine->numPriorOrds = n;
+
+	for ( Vector<LibMachine::Embed>::Iter e = libMachine->embeds; e.lte(); e++ ) {
+		if ( e->type == LibMachine::TransPrior || e->type == LibMachine::OutPrior )
+			e->ordering = priorOrds[e->ordering];
+		else
+			e->ordering = actionOrds[e->ordering];
+	}
+}
+
+/* Flatten an exported machine for a library. Actions go in as their inline
+ * code and priorities by name or key. Conditions, error actions and anything
+ * that refers to states of this parse can't be stored. */
+LibMachine *ParseData::makeLibMachine( GraphDictEl *gdel, FsmAp *fsm )
+{
+	LibMachine *libMachine = new LibMachine;
+	libMachine->name = gdel->value->name;
+	libMachine->isSigned = fsmCtx->keyOps->isSigned;
+	libMachine->minKey = fsmCtx->keyOps->minKey.getVal();
+	libMachine->maxKey = fsmCtx->keyOps->maxKey.getVal();
+	libMachine->numStates = fsm->stateList.length();
+
+	LibEmbedMaker embedMaker( this, libMachine );
+	if ( fsm->entryPoints.length() > 0 )
+		embedMaker.bad = "entry points";
+
+	/* Number the states in list order. */
+	std::map<StateAp*, long> stateIds;
+	for ( StateList::Iter st = fsm->stateList; st.lte(); st++ ) {
+		long stateId = stateIds.size();
+		stateIds[st] = stateId;
+	}
+
+	libMachine->startState = stateIds[fsm->startState];
+
+	for ( StateList::Iter st = fsm->stateList; st.lte(); st++ ) {
+		long stateId = stateIds[st];
+		if ( st->isFinState() )
+			libMachine->finStates.append( stateId );
+
+		if ( st->errActionTable.length() > 0 )
+			embedMaker.bad = "error actions";
+		else if ( st->outCondSpace != 0 )
+			embedMaker.bad = "conditions";
+		else if ( st->nfaOut != 0 )
+			embedMaker.bad = "nfa transitions";
+
+		embedMaker.actionTable( LibMachine::ToStateAction, stateId, st->toStateActionTable );
+		embedMaker.actionTable( LibMachine::FromStateAction, stateId, st->fromStateActionTable );
+		embedMaker.actionTable( LibMachine::EofAction, stateId, st->eofActionTable );
+		embedMaker.actionTable( LibMachine::OutAction, stateId, st->outActionTable );
+		embedMaker.priorTable( LibMachine::OutPrior, stateId, st->outPriorTable );
+
+		for ( TransList::Iter trans = st->outList; trans.lte(); trans++ ) {
+			if ( !trans->plain() ) {
+				embedMaker.bad = "conditions";
+				break;
+			}
+
+			long transId = libMachine->trans.length();
+			StateAp *toState = trans->tdap()->toState;
+
+			LibMachine::Trans t;
+			t.from = stateId;
+			t.to = toState != 0 ? stateIds[toState] : -1;
+			t.lowKey = trans->lowKey.getVal();
+			t.highKey = trans->highKey.getVal();
+			libMachine->trans.append( t );
+
+			embedMaker.actionTable( LibMachine::TransAction, transId,
+					trans->tdap()->actionTable );
+			embedMaker.priorTable( LibMachine::TransPrior, transId,
+					trans->tdap()->priorTable );
+		}
+	}
+
+	if ( embedMaker.bad != 0 ) {
+		error(gdel->loc) << "library machine \"" << gdel->value->name <<
+				"\" has " << embedMaker.bad << ", which can't be stored" << endl;
+		delete libMachine;
+		return 0;
+	}
+
+	embedMaker.finish();
+	return libMachine;
+}
+
+/* A section with no instantiations can still export machines to a library.
+ * Does just enough of the machine preparation to walk the exports. */
+void ParseData::prepareLibrary( const HostLang *hostLang )
+{
+	initKeyOps( hostLang );
+	makeRootNames();
+	initLongestMatchData();
+	makeNameTree( 0 );
+	makeExports();
+}
+
 FsmRes ParseData::prepareMachineGen( GraphDictEl *graphDictEl, const HostLang *hostLang )
 {
 	initKeyOps( hostLang );
@@ -1432,8 +2683,10 @@ FsmRes ParseData::prepareMachineGen( GraphDictEl *graphDictEl, const HostLang *h
 		sectionGraph = res.fsm;
 	}
 	
-	/* If any errors have occured in the input file then don't write anything. */
-	if ( id->errorCount > 0 )
+	/* If any errors have occured in the input file then don't write anything.
+	 * On a codegen worker only the section's own errors are looked at, the
+	 * others stop the output when the pool is done. */
+	if ( ( !holdReports && id->errorCount > 0 ) || sectionErrors > 0 )
 		return FsmRes( FsmRes::InternalError() );
 
 	fsmCtx->analyzeGraph( sectionGraph );
@@ -1476,14 +2729,31 @@ void ParseData::generateXML( ostream &out )
 }
 #endif
 
+void ParseData::clearBuiltins()
+{
+	for ( int b = 0; b < NUM_BUILTINS; b++ ) {
+		delete builtinFsms[b];
+		builtinFsms[b] = 0;
+	}
+}
+
 void ParseData::clear()
 {
-	cgd->clear();
+	if ( cgd != 0 )
+		cgd->clear();
 
 	delete sectionGraph;
 	sectionGraph = 0;
 
+	clearBuiltins();
+
+	/* The instance list shares its elements with the graph dict. */
+	instanceList.abandon();
 	graphDict.empty();
+	graphIndex.empty();
+
+	/* Release the parse tree in one shot. */
+	arena.clear();
 
 	/* Delete all the nodes in the action list. Will cause all the
 	 * string data that represents the actions to be deallocated. */
@@ -28,6 +28,7 @@
 #include <sstream>
 #include <vector>
 #include <set>
+#include <map>
 
 #include "avlmap.h"
 #include "bstmap.h"
@@ -79,6 +80,112 @@ struct IncludeHistoryItem
 
 typedef std::vector<IncludeHistoryItem> IncludeHistory;
 
+/* The variables a suspended machine needs saved, from the features it uses. */
+struct SnapshotLayout
+{
+	SnapshotLayout() : stack(false), act(false), tokens(false), maxActId(0) {}
+
+	/* Calls and returns, so top and the stack. */
+	bool stack;
+
+	/* Scanner with more than one way to finish a token, so act. */
+	bool act;
+
+	/* Scanner, so ts and te. */
+	bool tokens;
+
+	long maxActId;
+};
+
+/* A machine from a precompiled library. States are numbered from zero and
+ * the transitions are kept grouped by source state, in key order. Actions are
+ * stored as their inline code, so only code that does not refer to states,
+ * scanners or action arguments can go in. Priorities are stored by name, or
+ * by key for unnamed ones. Conditions are not stored. */
+struct LibMachine
+{
+	LibMachine() : numActionOrds(0), numPriorOrds(0) {}
+
+	struct Trans
+	{
+		long from, to;
+		long lowKey, highKey;
+	};
+
+	/* Where an action or priority is embedded. */
+	enum EmbedType
+	{
+		TransAction,
+		TransPrior,
+		ToStateAction,
+		FromStateAction,
+		EofAction,
+		OutAction,
+		OutPrior
+	};
+
+	/* An action or priority on a transition or a state. The target indexes
+	 * trans for the transition types and is a state otherwise. Orderings are
+	 * numbered from zero and are offset when the machine is made. */
+	struct Embed
+	{
+		long type;
+		long target;
+		long ordering;
+		long index;
+	};
+
+	/* An inline item, in preorder. Items with no child list have
+	 * numChildren -1. */
+	struct ItemDef
+	{
+		long type;
+		std::string data;
+		long numChildren;
+	};
+
+	struct ActionDef
+	{
+		std::string name;
+		std::string fileName;
+		long line, col;
+		std::vector<ItemDef> items;
+	};
+
+	/* A named priority is matched by name in the loading section. Unnamed
+	 * priorities keep their keys apart from each other. */
+	struct PriorDef
+	{
+		std::string name;
+		long key;
+		long priority;
+	};
+
+	std::string name;
+
+	/* Alphabet the machine was compiled for. */
+	bool isSigned;
+	long minKey, maxKey;
+
+	long numStates;
+	long startState;
+	Vector<long> finStates;
+	Vector<Trans> trans;
+
+	std::vector<ActionDef> actions;
+	std::vector<PriorDef> priors;
+	Vector<Embed> embeds;
+	long numActionOrds;
+	long numPriorOrds;
+
+	bool checkEmbeds();
+	Action **makeActions( ParseData *pd );
+	PriorDesc *makePriorDescs( ParseData *pd );
+	FsmAp *makeFsm( ParseData *pd, Action **actionMap, PriorDesc *priorMap );
+};
+
+typedef Vector<LibMachine*> LibMachineList;
+
 /* Graph dictionary. */
 struct GraphDictEl 
 :
@@ -89,11 +196,6 @@ struct GraphDictEl
 		: key(k), value(0), isInstance(false) { }
 	GraphDictEl( std::string k, VarDef *value ) 
 		: key(k), value(value), isInstance(false) { }
-	
-	~GraphDictEl()
-	{
-		delete value;
-	}
 
 	std::string getKey() { return key; }
 
@@ -130,6 +232,17 @@ struct NameFrame
 	NameInst *prevLocalScope;
 };
 
+/* Snapshot of the state advanced by a walk of the parse tree. Lets a
+ * subexpression be walked again after its graph has been abandoned. */
+struct WalkFrame
+{
+	NameFrame nameFrame;
+	int nextEpsilonResolvedLink;
+	long numCuts;
+	int curActionOrd;
+	int curPriorOrd;
+};
+
 struct LengthDef
 {
 	LengthDef( char *name )
@@ -141,6 +254,19 @@ struct LengthDef
 
 typedef DList<LengthDef> LengthDefList;
 
+/* A message held back while a section generates on a codegen worker. */
+struct SectionReport
+{
+	enum Type { Error, Warning, Stats };
+
+	SectionReport( Type type, const InputLoc &loc )
+		: type(type), loc(loc) {}
+
+	Type type;
+	InputLoc loc;
+	std::ostringstream text;
+};
+
 extern const int ORD_PUSH;
 extern const int ORD_RESTORE;
 extern const int ORD_COND;
@@ -165,6 +291,7 @@ struct ParseData
 	/* Initialize a graph dict with the basic fsms. */
 	void initGraphDict();
 	void createBuiltin( const char *name, BuiltinMachine builtin );
+	void createLibMachine( LibMachine *libMachine );
 
 	/* Make a name id in the current name instantiation scope if it is not
 	 * already there. */
@@ -179,9 +306,10 @@ struct ParseData
 	void unsetObsoleteEntries( FsmAp *graph );
 
 	/* Resove name references in action code and epsilon transitions. */
-	NameSet resolvePart( NameInst *refFrom, const std::string &data, bool recLabelsOnly );
+	NameSet resolvePart( NameInst *refFrom, int sym, bool recLabelsOnly );
+	void nameRefSymbols( Vector<int> &syms, NameRef *nameRef );
 	void resolveFrom( NameSet &result, NameInst *refFrom, 
-			NameRef *nameRef, int namePos );
+			const Vector<int> &syms, int namePos );
 	NameInst *resolveStateRef( NameRef *nameRef, InputLoc &loc, Action *action );
 	void resolveNameRefs( InlineList *inlineList, Action *action );
 	void resolveActionNameRefs();
@@ -194,6 +322,7 @@ struct ParseData
 
 	/* Override one of the variables ragel uses. */
 	bool setVariable( const char *var, InlineList *inlineList );
+	void snapshotLayout( SnapshotLayout &layout );
 
 	/* Dumping the name instantiation tree. */
 	void printNameInst( std::ostream &out, NameInst *nameInst, int level );
@@ -203,6 +332,7 @@ struct ParseData
 
 	void reportBreadthResults( BreadthResult *breadth );
 	BreadthResult *checkBreadth( FsmAp *fsm );
+	double *makeHistogram( FsmAp *fsm, StateAp *entry );
 	void reportAnalysisResult( FsmRes &res );
 
 	/* Make the graph from a graph dict node. Does minimization. */
@@ -211,6 +341,10 @@ struct ParseData
 	FsmRes makeAll();
 
 	void makeExports();
+	bool prefilterKey( Key &key );
+	bool nfaStates();
+	LibMachine *makeLibMachine( GraphDictEl *gdel, FsmAp *fsm );
+	void prepareLibrary( const HostLang *hostLang );
 
 	FsmRes prepareMachineGen( GraphDictEl *graphDictEl, const HostLang *hostLang );
 	void generateXML( ostream &out );
@@ -220,17 +354,47 @@ struct ParseData
 	std::string sectionName;
 	FsmAp *sectionGraph;
 
+	/* Exports flattened for --write-library, written in section order. */
+	Vector<LibMachine*> libExports;
+
 	void initKeyOps( const HostLang *hostLang );
 
 	void errorStateLabels( const NameSet &resolved );
 
+	/* Reporting for the section. Counts the section's own errors and, when
+	 * reports are held, buffers them until flushReports. */
+	std::ostream &error( const InputLoc &loc );
+	std::ostream &error();
+	std::ostream &warning( const InputLoc &loc );
+	std::ostream &stats();
+	std::ostream &holdReport( SectionReport::Type type, const InputLoc &loc );
+	void flushReports();
+
+	bool holdReports;
+	int sectionErrors;
+	Vector<SectionReport*> reports;
+
+	/* Union walked as an NFA union after going over the memory limit. */
+	Expression *nfaFallbackExpr;
+
 	/*
 	 * Data collected during the parse.
 	 */
 
+	/* Owns the parse tree. Declared ahead of the graph dict so it outlives
+	 * it. */
+	ParseArena arena;
+
 	/* Dictionary of graphs. Both instances and non-instances go here. */
 	GraphDict graphDict;
 
+	/* The graph dict elements by symbol id, for lookups by name. The dict
+	 * keeps them in name order for the walks over it. */
+	Vector<GraphDictEl*> graphIndex;
+	GraphDictEl *findGraph( const std::string &name );
+	GraphDictEl *insertGraph( const std::string &name );
+	void insertGraph( GraphDictEl *graphDictEl );
+
 	/* The list of instances. */
 	GraphList instanceList;
 
@@ -273,6 +437,9 @@ struct ParseData
 	 * other root is for exported definitions. */
 	NameInst *rootName;
 	NameInst *exportsRootName;
+
+	/* Every instance of each name in the name tree, by symbol id. */
+	Vector<NameVect> nameIndex;
 	
 	/* Name tree walking. */
 	NameInst *curNameInst;
@@ -296,6 +463,9 @@ struct ParseData
 	NameFrame enterNameScope( bool isLocal, int numScopes );
 	void popNameScope( const NameFrame &frame );
 	void resetNameScope( const NameFrame &frame );
+	WalkFrame saveWalk();
+	void restoreWalk( const WalkFrame &frame );
+	Expression *memoryFallbackUnion( VarDef *varDef );
 
 	void nfaTermCheckKleeneZero();
 	void nfaTermCheckMinZero();
@@ -304,6 +474,11 @@ struct ParseData
 	void nfaTermCheckZeroReps();
 
 	void clear();
+	void clearBuiltins();
+
+	/* Builtin machines made for this section's alphabet, copied for each
+	 * reference. */
+	FsmAp *builtinFsms[NUM_BUILTINS];
 
 	/* Counter for assigning ids to longest match items. */
 	int nextLongestMatchId;
@@ -356,6 +531,7 @@ struct ParseData
 	std::set<std::string> actionParams;
 };
 
+long graphMemory( FsmAp *fsm );
 Key makeFsmKeyHex( char *str, const InputLoc &loc, ParseData *pd );
 Key makeFsmKeyDec( char *str, const InputLoc &loc, ParseData *pd );
 Key makeFsmKeyNum( char *str, const InputLoc &loc, ParseData *pd );
@@ -363,15 +539,18 @@ Key makeFsmKeyChar( char c, ParseData *pd );
 void makeFsmKeyArray( Key *result, char *data, int len, ParseData *pd );
 void makeFsmUniqueKeyArray( KeySet &result, const char *data, int len, 
 		bool caseInsensitive, ParseData *pd );
+long decodeUtf8( const char *data, long length, long &pos );
+FsmAp *makeUtf8RangeFsm( ParseData *pd, long low, long high );
+bool checkUtf8Alphabet( ParseData *pd, const InputLoc &loc );
 FsmAp *makeBuiltin( BuiltinMachine builtin, ParseData *pd );
 FsmAp *dotFsm( ParseData *pd );
 FsmAp *dotStarFsm( ParseData *pd );
 
 Key *prepareHexString( ParseData *pd, const InputLoc &loc,
 		const char *data, long length, long &resLen );
-char *prepareLitString( InputData *id, const InputLoc &loc, const char *data, long length, 
+char *prepareLitString( ParseData *pd, const InputLoc &loc, const char *data, long length, 
 		long &resLen, bool &caseInsensitive );
-const char *checkLitOptions( InputData *id, const InputLoc &loc,
+const char *checkLitOptions( ParseData *pd, const InputLoc &loc,
 		const char *data, int length, bool &caseInsensitive );
 
 #endif
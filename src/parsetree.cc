@@ -26,6 +26,8 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <map>
+#include <vector>
 #include "inputdata.h"
 
 /* Parsing. */
@@ -34,12 +36,84 @@
 #include "parsetree.h"
 #include "parsedata.h"
 
+/* Unions of at least this many plain literals are built directly as a trie. */
+#define LITERAL_TRIE_MIN 8
+
 using namespace std;
 ostream &operator<<( ostream &out, const NameRef &nameRef );
 ostream &operator<<( ostream &out, const NameInst &nameInst );
 
+/* Strictest alignment a parse tree node can need. */
+union ArenaAlign
+{
+	long double ld;
+	long long ll;
+	void *p;
+	void (*fp)();
+};
+
+static size_t arenaAlign( size_t size )
+{
+	const size_t a = sizeof(ArenaAlign);
+	return ( size + a - 1 ) / a * a;
+}
+
+void *ParseArena::allocate( size_t size, void (*destroy)( void *obj ) )
+{
+	size_t need = arenaAlign( sizeof(Header) ) + arenaAlign( size );
+	if ( need > left ) {
+		/* Oversized objects get a block of their own. */
+		size_t dataSize = blockSize;
+		if ( need > dataSize )
+			dataSize = need;
+		char *mem = new char[arenaAlign( sizeof(Block) ) + dataSize];
+
+		Block *newBlock = (Block*)mem;
+		newBlock->prev = block;
+		block = newBlock;
+
+		avail = mem + arenaAlign( sizeof(Block) );
+		left = dataSize;
+	}
+
+	Header *header = (Header*)avail;
+	header->prev = lastHeader;
+	header->destroy = destroy;
+	lastHeader = header;
+
+	void *obj = avail + arenaAlign( sizeof(Header) );
+	avail += need;
+	left -= need;
+	return obj;
+}
+
+/* Construction of the most recent object failed. Don't destroy it. */
+void ParseArena::abandon( void *obj )
+{
+	if ( lastHeader != 0 && (char*)lastHeader + arenaAlign( sizeof(Header) ) == obj )
+		lastHeader->destroy = 0;
+}
+
+void ParseArena::clear()
+{
+	for ( Header *header = lastHeader; header != 0; header = header->prev ) {
+		if ( header->destroy != 0 )
+			header->destroy( (char*)header + arenaAlign( sizeof(Header) ) );
+	}
+
+	while ( block != 0 ) {
+		Block *prev = block->prev;
+		delete[] (char*)block;
+		block = prev;
+	}
+
+	avail = 0;
+	left = 0;
+	lastHeader = 0;
+}
+
 /* Read string literal (and regex) options and return the true end. */
-const char *checkLitOptions( InputData *id, const InputLoc &loc,
+const char *checkLitOptions( ParseData *pd, const InputLoc &loc,
 		const char *data, int length, bool &caseInsensitive )
 {
 	const char *end = data + length - 1;
@@ -47,7 +121,7 @@ const char *checkLitOptions( InputData *id, const InputLoc &loc,
 		if ( *end == 'i' )
 			caseInsensitive = true;
 		else {
-			id->error( loc ) << "literal string '" << *end << 
+			pd->error( loc ) << "literal string '" << *end << 
 					"' option not supported" << endl;
 		}
 		end -= 1;
@@ -59,14 +133,14 @@ const char *checkLitOptions( InputData *id, const InputLoc &loc,
  * characters with escapes and options interpreted. Also null terminates the
  * string. Though this null termination should not be relied on for
  * interpreting literals in the parser because the string may contain \0 */
-char *prepareLitString( InputData *id, const InputLoc &loc, const char *data, long length, 
+char *prepareLitString( ParseData *pd, const InputLoc &loc, const char *data, long length, 
 		long &resLen, bool &caseInsensitive )
 {
 	char *resData = new char[length+1];
 	caseInsensitive = false;
 
 	const char *src = data + 1;
-	const char *end = checkLitOptions( id, loc, data, length, caseInsensitive );
+	const char *end = checkLitOptions( pd, loc, data, length, caseInsensitive );
 
 	char *dest = resData;
 	long dlen = 0;
@@ -197,11 +271,6 @@ void VarDef::resolveNameRefs( ParseData *pd )
 	pd->popNameScope( nameFrame );
 }
 
-VarDef::~VarDef()
-{
-	delete machineDef;
-}
-
 InputLoc LongestMatchPart::getLoc()
 { 
 	return action != 0 ? action->loc : semiLoc;
@@ -474,8 +543,6 @@ FsmRes LongestMatch::walk( ParseData *pd )
 
 NfaUnion::~NfaUnion()
 {
-	for ( TermVect::Iter term = terms; term.lte(); term++ )
-		delete *term;
 	if ( roundsList != 0 )
 		delete roundsList;
 }
@@ -483,7 +550,7 @@ NfaUnion::~NfaUnion()
 FsmRes NfaUnion::walk( ParseData *pd )
 {
 	if ( pd->id->printStatistics )
-		pd->id->stats() << "nfa union terms\t" << terms.length() << endl;
+		pd->stats() << "nfa union terms\t" << terms.length() << endl;
 
 	/* Compute the individual expressions. */
 	long numMachines = 0;
@@ -501,7 +568,7 @@ FsmRes NfaUnion::walk( ParseData *pd )
 		machines[numMachines++] = res.fsm;
 	}
 
-	std::ostream &stats = pd->id->stats();
+	std::ostream &stats = pd->stats();
 	bool printStatistics = pd->id->printStatistics;
 
 	return FsmAp::nfaUnion( *roundsList, machines, numMachines, stats, printStatistics );
@@ -571,14 +638,10 @@ void MachineDef::resolveNameRefs( ParseData *pd )
 
 MachineDef::~MachineDef()
 {
-	if ( join != 0 )
-		delete join;
 	if ( longestMatch != 0 )
 		delete longestMatch;
 	if ( lengthDef != 0 )
 		delete lengthDef;
-	if ( nfaUnion != 0 )
-		delete nfaUnion;
 }
 
 /* Construct with a location and the first expression. */
@@ -686,13 +749,14 @@ void Join::resolveNameRefs( ParseData *pd )
 		NameFrame nameFrame = pd->enterNameScope( true, 1 );
 
 		/* The join scope must contain a start label. */
-		NameSet resolved = pd->resolvePart( pd->localNameScope, "start", true );
+		NameSet resolved = pd->resolvePart( pd->localNameScope,
+				pd->id->symbols.find( "start" ), true );
 		if ( resolved.length() > 0 ) {
 			/* Take the first. */
 			pd->curNameInst->start = resolved[0];
 			if ( resolved.length() > 1 ) {
 				/* Complain about the multiple references. */
-				pd->id->error(loc) << "join operation has multiple start labels" << endl;
+				pd->error(loc) << "join operation has multiple start labels" << endl;
 				pd->errorStateLabels( resolved );
 			}
 		}
@@ -704,7 +768,7 @@ void Join::resolveNameRefs( ParseData *pd )
 		}
 		else {
 			/* No start label. */
-			pd->id->error(loc) << "join operation has no start label" << endl;
+			pd->error(loc) << "join operation has no start label" << endl;
 		}
 
 		/* Recurse into all expressions in the list. */
@@ -720,13 +784,316 @@ void Join::resolveNameRefs( ParseData *pd )
 	}
 }
 
-/* Clean up after an expression node. */
-Expression::~Expression()
+/* Evaluate a chain of unions. */
+FsmRes Expression::walkOr( ParseData *pd, bool lastInSeq )
+{
+	/* Evaluate the expression. */
+	FsmRes exprFsm = expression->type == OrType ?
+			expression->walkOr( pd, false ) :
+			expression->walk( pd, false );
+	if ( !exprFsm.success() )
+		return exprFsm;
+
+	/* Evaluate the term. */
+	FsmRes rhs = term->walk( pd );
+	if ( !rhs.success() ) {
+		delete exprFsm.fsm;
+		return rhs;
+	}
+
+	/* Perform union. */
+	return FsmAp::unionOp( exprFsm.fsm, rhs.fsm, lastInSeq );
+}
+
+/* Build the alternatives of a union chain separately and join them with an
+ * NFA union. Used at the top level of an instance when the deterministic
+ * union exceeds the memory limit. There are no rounds, so the alternatives are
+ * not merged at all. */
+FsmRes Expression::walkNfaFallback( ParseData *pd )
 {
-	if ( expression )
-		delete expression;
-	if ( term )
-		delete term;
+	/* The chain is left recursive. Collect it so the alternatives are walked
+	 * in the same order as the deterministic walk. */
+	Vector<Expression*> chain;
+	Expression *first = this;
+	while ( first->type == OrType ) {
+		chain.prepend( first );
+		first = first->expression;
+	}
+
+	pd->warning( loc ) << "memory limit exceeded in union of " <<
+			( chain.length() + 1 ) << " alternatives, retrying as nfa union" << endl;
+
+	if ( pd->id->printStatistics )
+		pd->stats() << "memory limit fallback\t" << ( chain.length() + 1 ) << endl;
+
+	long numMachines = 0;
+	FsmAp **machines = new FsmAp*[chain.length() + 1];
+
+	FsmRes res = first->walk( pd );
+	if ( res.success() ) {
+		machines[numMachines++] = res.fsm;
+
+		for ( Vector<Expression*>::Iter expr = chain; expr.lte(); expr++ ) {
+			res = (*expr)->term->walk( pd );
+			if ( !res.success() )
+				break;
+
+			machines[numMachines++] = res.fsm;
+		}
+	}
+
+	if ( !res.success() ) {
+		for ( int m = 0; m < numMachines; ++m )
+			delete machines[m];
+		delete[] machines;
+		return res;
+	}
+
+	NfaRoundVect roundsList;
+	return FsmAp::nfaUnion( roundsList, machines, numMachines,
+			pd->stats(), pd->id->printStatistics );
+}
+
+/* If a term is nothing more than a literal, with no actions, priorities,
+ * conditions, labels or operators applied, return the literal. */
+static Literal *plainLiteral( Term *term )
+{
+	if ( term->type != Term::FactorWithAugType )
+		return 0;
+
+	FactorWithAug *fwa = term->factorWithAug;
+	if ( fwa->actions.length() > 0 || fwa->priorityAugs.length() > 0 ||
+			fwa->labels.size() > 0 || fwa->epsilonLinks.length() > 0 ||
+			fwa->conditions.length() > 0 )
+		return 0;
+
+	FactorWithRep *fwr = fwa->factorWithRep;
+	if ( fwr->type != FactorWithRep::FactorWithNegType )
+		return 0;
+
+	FactorWithNeg *fwn = fwr->factorWithNeg;
+	if ( fwn->type != FactorWithNeg::FactorType )
+		return 0;
+
+	Factor *factor = fwn->factor;
+	if ( factor->type != Factor::LiteralType )
+		return 0;
+
+	return factor->literal;
+}
+
+/* With --utf8 a number above 0x7f is a code point of several bytes. The trie
+ * takes each literal as a single key, so it can't hold one. */
+static bool multiByteLiteral( ParseData *pd, Literal *lit )
+{
+	long cp;
+	return pd->id->utf8 && lit->type == Literal::Number &&
+			lit->codePoint( pd, cp, false ) && cp > 0x7f;
+}
+
+/* Collect the alternatives of a union chain, provided every one of them is a
+ * plain literal that the trie can take and there are enough of them for the
+ * trie to pay off. */
+bool Expression::literalChain( ParseData *pd, Vector<Literal*> &lits )
+{
+	Expression *expr = this;
+	while ( expr->type == OrType ) {
+		Literal *lit = plainLiteral( expr->term );
+		if ( lit == 0 || multiByteLiteral( pd, lit ) )
+			return false;
+		lits.append( lit );
+		expr = expr->expression;
+	}
+
+	if ( expr->type != TermType )
+		return false;
+
+	Literal *lit = plainLiteral( expr->term );
+	if ( lit == 0 || multiByteLiteral( pd, lit ) )
+		return false;
+	lits.append( lit );
+	return lits.length() >= LITERAL_TRIE_MIN;
+}
+
+/* Trie over the keys of a literal union. Case-insensitive literals are stored
+ * folded to lower case. */
+struct TrieNode
+{
+	TrieNode() : final(false), canon(-1) {}
+
+	struct Edge
+	{
+		Key key;
+		TrieNode *child;
+	};
+
+	bool final;
+	Vector<Edge> edges;
+
+	/* Index of the equivalent node in the minimized graph. */
+	int canon;
+};
+
+struct LiteralTrie
+{
+	LiteralTrie( KeyOps *keyOps ) : keyOps(keyOps) {}
+	~LiteralTrie();
+
+	void insert( Key *keys, long length, bool fold );
+	int minimize( TrieNode *node );
+	FsmAp *makeFsm( FsmCtx *fsmCtx, bool caseInsensitive );
+
+	KeyOps *keyOps;
+	TrieNode root;
+
+	/* Distinct nodes, indexed by canon. */
+	Vector<TrieNode*> canonNodes;
+	std::map< std::vector<long>, int > registry;
+};
+
+static void deleteTrieChildren( TrieNode *node )
+{
+	for ( Vector<TrieNode::Edge>::Iter e = node->edges; e.lte(); e++ ) {
+		deleteTrieChildren( e->child );
+		delete e->child;
+	}
+}
+
+LiteralTrie::~LiteralTrie()
+{
+	deleteTrieChildren( &root );
+}
+
+void LiteralTrie::insert( Key *keys, long length, bool fold )
+{
+	TrieNode *node = &root;
+	for ( long i = 0; i < length; i++ ) {
+		Key key = keys[i];
+		if ( fold && key.isUpper() )
+			key = key.toLower();
+
+		/* Edges are kept sorted. Binary search for the key. */
+		long low = 0, high = node->edges.length();
+		while ( low < high ) {
+			long mid = ( low + high ) / 2;
+			if ( keyOps->lt( node->edges[mid].key, key ) )
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		if ( low < node->edges.length() && !keyOps->lt( key, node->edges[low].key ) )
+			node = node->edges[low].child;
+		else {
+			TrieNode::Edge edge;
+			edge.key = key;
+			edge.child = new TrieNode;
+			node->edges.insert( low, edge );
+			node = edge.child;
+		}
+	}
+	node->final = true;
+}
+
+/* Bottom up, merge nodes with identical finality and identical outgoing
+ * edges. The result is the minimal DAWG for the key set. */
+int LiteralTrie::minimize( TrieNode *node )
+{
+	std::vector<long> sig;
+	sig.push_back( node->final ? 1 : 0 );
+	for ( Vector<TrieNode::Edge>::Iter e = node->edges; e.lte(); e++ ) {
+		sig.push_back( e->key.getVal() );
+		sig.push_back( minimize( e->child ) );
+	}
+
+	std::map< std::vector<long>, int >::iterator found = registry.find( sig );
+	if ( found != registry.end() )
+		node->canon = found->second;
+	else {
+		node->canon = canonNodes.length();
+		canonNodes.append( node );
+		registry.insert( std::make_pair( sig, node->canon ) );
+	}
+	return node->canon;
+}
+
+FsmAp *LiteralTrie::makeFsm( FsmCtx *fsmCtx, bool caseInsensitive )
+{
+	minimize( &root );
+
+	FsmAp *fsm = new FsmAp( fsmCtx );
+	StateAp **states = new StateAp*[canonNodes.length()];
+	for ( int c = 0; c < canonNodes.length(); c++ ) {
+		states[c] = fsm->addState();
+		if ( canonNodes[c]->final )
+			fsm->setFinState( states[c] );
+	}
+
+	for ( int c = 0; c < canonNodes.length(); c++ ) {
+		TrieNode *node = canonNodes[c];
+		if ( !caseInsensitive ) {
+			for ( Vector<TrieNode::Edge>::Iter e = node->edges; e.lte(); e++ )
+				fsm->attachNewTrans( states[c], states[e->child->canon], e->key, e->key );
+		}
+		else {
+			/* Unfold the edges. Folded keys are distinct, so the unfolded
+			 * keys are too, but they need sorting again. */
+			KeySet keySet( keyOps );
+			std::map<long, int> targets;
+			for ( Vector<TrieNode::Edge>::Iter e = node->edges; e.lte(); e++ ) {
+				keySet.insert( e->key );
+				targets[e->key.getVal()] = e->child->canon;
+				if ( e->key.isLower() ) {
+					keySet.insert( e->key.toUpper() );
+					targets[e->key.toUpper().getVal()] = e->child->canon;
+				}
+			}
+
+			for ( int k = 0; k < keySet.length(); k++ ) {
+				fsm->attachNewTrans( states[c], states[targets[keySet[k].getVal()]],
+						keySet[k], keySet[k] );
+			}
+		}
+	}
+
+	fsm->setStartState( states[root.canon] );
+	delete[] states;
+	return fsm;
+}
+
+/* Build a union of plain literals directly as a trie, then merge common
+ * suffixes. Avoids unioning each alternative into the growing machine. */
+FsmRes Expression::walkLiteralTrie( ParseData *pd, Vector<Literal*> &lits, bool lastInSeq )
+{
+	KeyOps *keyOps = pd->fsmCtx->keyOps;
+	LiteralTrie exact( keyOps ), folded( keyOps );
+	long numExact = 0, numFolded = 0;
+
+	for ( Vector<Literal*>::Iter lit = lits; lit.lte(); lit++ ) {
+		long length;
+		bool caseInsensitive;
+		Key *keys = (*lit)->makeKeys( pd, length, caseInsensitive );
+		if ( caseInsensitive ) {
+			folded.insert( keys, length, true );
+			numFolded += 1;
+		}
+		else {
+			exact.insert( keys, length, false );
+			numExact += 1;
+		}
+		delete[] keys;
+	}
+
+	if ( pd->id->printStatistics )
+		pd->stats() << "literal trie\t" << lits.length() << endl;
+
+	if ( numFolded == 0 )
+		return FsmRes( FsmRes::Fsm(), exact.makeFsm( pd->fsmCtx, false ) );
+	if ( numExact == 0 )
+		return FsmRes( FsmRes::Fsm(), folded.makeFsm( pd->fsmCtx, true ) );
+
+	return FsmAp::unionOp( exact.makeFsm( pd->fsmCtx, false ),
+			folded.makeFsm( pd->fsmCtx, true ), lastInSeq );
 }
 
 /* Evaluate a single expression node. */
@@ -734,22 +1101,17 @@ FsmRes Expression::walk( ParseData *pd, bool lastInSeq )
 {
 	switch ( type ) {
 		case OrType: {
-			/* Evaluate the expression. */
-			FsmRes exprFsm = expression->walk( pd, false );
-			if ( !exprFsm.success() )
-				return exprFsm;
+			/* Long unions of plain literals are built as a trie. */
+			Vector<Literal*> lits;
+			if ( literalChain( pd, lits ) )
+				return walkLiteralTrie( pd, lits, lastInSeq );
 
-			/* Evaluate the term. */
-			FsmRes rhs = term->walk( pd );
-			if ( !rhs.success() )
-				return rhs;
+			/* The top level union of an instance that went over the memory
+			 * limit. */
+			if ( this == pd->nfaFallbackExpr )
+				return walkNfaFallback( pd );
 
-			/* Perform union. */
-			FsmRes res = FsmAp::unionOp( exprFsm.fsm, rhs.fsm, lastInSeq );
-			if ( !res.success() )
-				return res;
-
-			return res;
+			return walkOr( pd, lastInSeq );
 		}
 		case IntersectType: {
 			/* Evaluate the expression. */
@@ -865,15 +1227,6 @@ void Expression::resolveNameRefs( ParseData *pd )
 	}
 }
 
-/* Clean up after a term node. */
-Term::~Term()
-{
-	if ( term )
-		delete term;
-	if ( factorWithAug )
-		delete factorWithAug;
-}
-
 /* Evaluate a term node. */
 FsmRes Term::walk( ParseData *pd, bool lastInSeq )
 {
@@ -1036,10 +1389,6 @@ void Term::resolveNameRefs( ParseData *pd )
 /* Clean up after a factor with augmentation node. */
 FactorWithAug::~FactorWithAug()
 {
-	delete factorWithRep;
-
-	/* Walk the vector of parser actions, deleting function names. */
-
 	/* Clean up priority descriptors. */
 	if ( priorDescs != 0 )
 		delete[] priorDescs;
@@ -1387,14 +1736,17 @@ void FactorWithAug::resolveNameRefs( ParseData *pd )
 		}
 		else {
 			/* Do an search for the name. */
+			Vector<int> syms;
+			pd->nameRefSymbols( syms, link.target );
+
 			NameSet resolved;
-			pd->resolveFrom( resolved, pd->localNameScope, link.target, 0 );
+			pd->resolveFrom( resolved, pd->localNameScope, syms, 0 );
 			if ( resolved.length() > 0 ) {
 				/* Take the first one. */
 				resolvedName = resolved[0];
 				if ( resolved.length() > 1 ) {
 					/* Complain about the multiple references. */
-					pd->id->error(link.loc) << "state reference " << link.target << 
+					pd->error(link.loc) << "state reference " << link.target << 
 							" resolves to multiple entry points" << endl;
 					pd->errorStateLabels( resolved );
 				}
@@ -1414,7 +1766,7 @@ void FactorWithAug::resolveNameRefs( ParseData *pd )
 		else {
 			/* Complain, no recovery action, the epsilon op will ignore any
 			 * epsilon transitions whose names did not resolve. */
-			pd->id->error(link.loc) << "could not resolve label " << link.target << endl;
+			pd->error(link.loc) << "could not resolve label " << link.target << endl;
 		}
 	}
 
@@ -1423,20 +1775,6 @@ void FactorWithAug::resolveNameRefs( ParseData *pd )
 }
 
 
-/* Clean up after a factor with repetition node. */
-FactorWithRep::~FactorWithRep()
-{
-	switch ( type ) {
-		case StarType: case StarStarType: case OptionalType: case PlusType:
-		case ExactType: case MaxType: case MinType: case RangeType:
-			delete factorWithRep;
-		case FactorWithNegType:
-			delete factorWithNeg;
-			break;
-	}
-}
-
-
 /* Evaluate a factor with repetition node. */
 FsmRes FactorWithRep::walk( ParseData *pd )
 {
@@ -1448,7 +1786,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 			return factorTree;
 		
 		if ( factorTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying kleene star to a machine that "
+			pd->warning(loc) << "applying kleene star to a machine that "
 					"accepts zero length word" << endl;
 			factorTree.fsm->unsetFinState( factorTree.fsm->startState );
 		}
@@ -1462,7 +1800,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 			return factorTree;
 
 		if ( factorTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying kleene star to a machine that "
+			pd->warning(loc) << "applying kleene star to a machine that "
 					"accepts zero length word" << endl;
 		}
 
@@ -1495,7 +1833,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 			return factorTree;
 
 		if ( factorTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying plus operator to a machine that "
+			pd->warning(loc) << "applying plus operator to a machine that "
 					"accepts zero length word" << endl;
 		}
 
@@ -1511,12 +1849,12 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 		if ( lowerRep == 0 ) {
 			/* No copies. Don't need to evaluate the factorWithRep. 
 			 * This Defeats the purpose so give a warning. */
-			pd->id->warning(loc) << "exactly zero repetitions results "
+			pd->warning(loc) << "exactly zero repetitions results "
 					"in the null machine" << endl;
 		}
 		else {
 			if ( factorTree.fsm->startState->isFinState() ) {
-				pd->id->warning(loc) << "applying repetition to a machine that "
+				pd->warning(loc) << "applying repetition to a machine that "
 						"accepts zero length word" << endl;
 			}
 		}
@@ -1534,7 +1872,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 		if ( upperRep == 0 ) {
 			/* No copies. Don't need to evaluate the factorWithRep. 
 			 * This Defeats the purpose so give a warning. */
-			pd->id->warning(loc) << "max zero repetitions results "
+			pd->warning(loc) << "max zero repetitions results "
 					"in the null machine" << endl;
 
 			return FsmRes( FsmRes::Fsm(), FsmAp::lambdaFsm( pd->fsmCtx ) );
@@ -1542,7 +1880,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 		else {
 
 			if ( factorTree.fsm->startState->isFinState() ) {
-				pd->id->warning(loc) << "applying max repetition to a machine that "
+				pd->warning(loc) << "applying max repetition to a machine that "
 						"accepts zero length word" << endl;
 			}
 		}
@@ -1557,7 +1895,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 			return factorTree;
 
 		if ( factorTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying min repetition to a machine that "
+			pd->warning(loc) << "applying min repetition to a machine that "
 					"accepts zero length word" << endl;
 		}
 	
@@ -1566,7 +1904,7 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 	case RangeType: {
 		/* Check for bogus range. */
 		if ( upperRep - lowerRep < 0 ) {
-			pd->id->error(loc) << "invalid range repetition" << endl;
+			pd->error(loc) << "invalid range repetition" << endl;
 
 			/* Return null machine as recovery. */
 			return FsmRes( FsmRes::Fsm(), FsmAp::lambdaFsm( pd->fsmCtx ) );
@@ -1580,13 +1918,13 @@ FsmRes FactorWithRep::walk( ParseData *pd )
 		if ( lowerRep == 0 && upperRep == 0 ) {
 			/* No copies. Don't need to evaluate the factorWithRep.  This
 			 * defeats the purpose so give a warning. */
-			pd->id->warning(loc) << "zero to zero repetitions results "
+			pd->warning(loc) << "zero to zero repetitions results "
 					"in the null machine" << endl;
 		}
 		else {
 
 			if ( factorTree.fsm->startState->isFinState() ) {
-				pd->id->warning(loc) << "applying range repetition to a machine that "
+				pd->warning(loc) << "applying range repetition to a machine that "
 						"accepts zero length word" << endl;
 			}
 
@@ -1638,20 +1976,6 @@ void FactorWithRep::resolveNameRefs( ParseData *pd )
 	}
 }
 
-/* Clean up after a factor with negation node. */
-FactorWithNeg::~FactorWithNeg()
-{
-	switch ( type ) {
-		case NegateType:
-		case CharNegateType:
-			delete factorWithNeg;
-			break;
-		case FactorType:
-			delete factor;
-			break;
-	}
-}
-
 /* Evaluate a factor with negation node. */
 FsmRes FactorWithNeg::walk( ParseData *pd )
 {
@@ -1712,31 +2036,11 @@ void FactorWithNeg::resolveNameRefs( ParseData *pd )
 /* Clean up after a factor node. */
 Factor::~Factor()
 {
-	switch ( type ) {
-		case LiteralType:
-			delete literal;
-			break;
-		case RangeType:
-			delete range;
-			break;
-		case OrExprType:
-			delete reItem;
-			break;
-		case RegExprType:
-			delete regExpr;
-			break;
-		case ReferenceType:
-			break;
-		case ParenType:
-			delete join;
-			break;
-		case LongestMatchType:
-			delete longestMatch;
-			break;
-		case NfaWrap: case NfaRep:
-		case CondStar: case CondPlus:
-			delete expression;
-			break;
+	if ( type == LongestMatchType )
+		delete longestMatch;
+	else if ( type == LibraryType ) {
+		delete[] libActions;
+		delete[] libPriorDescs;
 	}
 }
 
@@ -1807,7 +2111,7 @@ FsmRes Factor::walk( ParseData *pd )
 			return exprTree;
 
 		if ( exprTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying plus operator to a machine that "
+			pd->warning(loc) << "applying plus operator to a machine that "
 					"accepts zero length word" << endl;
 		}
 
@@ -1819,11 +2123,34 @@ FsmRes Factor::walk( ParseData *pd )
 			return exprTree;
 
 		if ( exprTree.fsm->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying plus operator to a machine that "
+			pd->warning(loc) << "applying plus operator to a machine that "
 					"accepts zero length word" << endl;
 		}
 
 		return FsmAp::condPlus( exprTree.fsm, repId, action1, action2, action3, action4 );
+	}
+	case LibraryType: {
+		/* The graph is ready, it only needs its states allocated. Check the
+		 * alphabet it was compiled for. */
+		KeyOps *keyOps = pd->fsmCtx->keyOps;
+		if ( libMachine->isSigned != keyOps->isSigned ||
+				libMachine->minKey != keyOps->minKey.getVal() ||
+				libMachine->maxKey != keyOps->maxKey.getVal() )
+		{
+			pd->error(loc) << "library machine \"" << libMachine->name <<
+					"\" was compiled for a different alphabet type" << endl;
+			return FsmRes( FsmRes::Fsm(), FsmAp::emptyFsm( pd->fsmCtx ) );
+		}
+
+		/* The actions and priority descriptors belong to this section and
+		 * are shared by every use of the machine. */
+		if ( libActions == 0 ) {
+			libActions = libMachine->makeActions( pd );
+			libPriorDescs = libMachine->makePriorDescs( pd );
+		}
+
+		return FsmRes( FsmRes::Fsm(), libMachine->makeFsm( pd,
+				libActions, libPriorDescs ) );
 	}}
 
 	return FsmRes( FsmRes::InternalError() );
@@ -1836,6 +2163,7 @@ void Factor::makeNameTree( ParseData *pd )
 	case RangeType:
 	case OrExprType:
 	case RegExprType:
+	case LibraryType:
 		break;
 	case ReferenceType:
 		varDef->makeNameTree( loc, pd );
@@ -1862,6 +2190,7 @@ void Factor::resolveNameRefs( ParseData *pd )
 	case RangeType:
 	case OrExprType:
 	case RegExprType:
+	case LibraryType:
 		break;
 	case ReferenceType:
 		varDef->resolveNameRefs( pd );
@@ -1881,27 +2210,37 @@ void Factor::resolveNameRefs( ParseData *pd )
 	}
 }
 
-/* Clean up a range object. Must delete the two literals. */
-Range::~Range()
-{
-	delete lowerLit;
-	delete upperLit;
-}
-
 /* Evaluate a range. Gets the lower an upper key and makes an fsm range. */
 FsmAp *Range::walk( ParseData *pd )
 {
+	/* In utf-8 mode a range that reaches past ascii is a range of code
+	 * points, matched as their byte sequences. */
+	long lowCp, highCp;
+	if ( pd->id->utf8 && lowerLit->codePoint( pd, lowCp ) &&
+			upperLit->codePoint( pd, highCp ) && highCp > 0x7f )
+	{
+		if ( !checkUtf8Alphabet( pd, lowerLit->loc ) )
+			return FsmAp::emptyFsm( pd->fsmCtx );
+
+		if ( lowCp > highCp ) {
+			pd->error(lowerLit->loc) << "lower end of range is greater then upper end" << endl;
+			highCp = lowCp;
+		}
+
+		return makeUtf8RangeFsm( pd, lowCp, highCp );
+	}
+
 	/* Construct and verify the suitability of the lower end of the range. */
 	FsmAp *lowerFsm = lowerLit->walk( pd );
 	if ( !lowerFsm->checkSingleCharMachine() ) {
-		pd->id->error(lowerLit->loc) << 
+		pd->error(lowerLit->loc) << 
 			"bad range lower end, must be a single character" << endl;
 	}
 
 	/* Construct and verify the upper end. */
 	FsmAp *upperFsm = upperLit->walk( pd );
 	if ( !upperFsm->checkSingleCharMachine() ) {
-		pd->id->error(upperLit->loc) << 
+		pd->error(upperLit->loc) << 
 			"bad range upper end, must be a single character" << endl;
 	}
 
@@ -1914,7 +2253,7 @@ FsmAp *Range::walk( ParseData *pd )
 	/* Validate the range. */
 	if ( pd->fsmCtx->keyOps->gt( lowKey, highKey ) ) {
 		/* Recover by setting upper to lower; */
-		pd->id->error(lowerLit->loc) << "lower end of range is greater then upper end" << endl;
+		pd->error(lowerLit->loc) << "lower end of range is greater then upper end" << endl;
 		highKey = lowKey;
 	}
 
@@ -1942,6 +2281,16 @@ FsmAp *Literal::walk( ParseData *pd )
 			num.insert( 0, '-' );
 		num.append( 0 );
 
+		/* In utf-8 mode numbers are code points. */
+		long cp;
+		if ( pd->id->utf8 && codePoint( pd, cp ) && cp > 0x7f ) {
+			if ( !checkUtf8Alphabet( pd, loc ) )
+				rtnVal = FsmAp::emptyFsm( pd->fsmCtx );
+			else
+				rtnVal = makeUtf8RangeFsm( pd, cp, cp );
+			break;
+		}
+
 		/* Make the fsm key in int format. */
 		Key fsmKey = makeFsmKeyNum( num.data, loc, pd );
 
@@ -1953,7 +2302,7 @@ FsmAp *Literal::walk( ParseData *pd )
 		/* Make the array of keys in int format. */
 		long length;
 		bool caseInsensitive;
-		char *litstr = prepareLitString( pd->id, loc, data.data, data.length(), 
+		char *litstr = prepareLitString( pd, loc, data.data, data.length(), 
 				length, caseInsensitive );
 		Key *arr = new Key[length];
 		makeFsmKeyArray( arr, litstr, length, pd );
@@ -1977,17 +2326,89 @@ FsmAp *Literal::walk( ParseData *pd )
 	return rtnVal;
 }
 
-/* Clean up after a regular expression object. */
-RegExpr::~RegExpr()
+/* Convert a literal to an array of keys, as its machine would match them.
+ * The caller owns the array. */
+Key *Literal::makeKeys( ParseData *pd, long &length, bool &caseInsensitive )
 {
+	Key *arr = 0;
+	caseInsensitive = false;
+
 	switch ( type ) {
-		case RecurseItem:
-			delete regExpr;
-			delete item;
-			break;
-		case Empty:
-			break;
+	case Number: {
+		Vector<char> num = data;
+		if ( neg )
+			num.insert( 0, '-' );
+		num.append( 0 );
+
+		length = 1;
+		arr = new Key[1];
+		arr[0] = makeFsmKeyNum( num.data, loc, pd );
+		break;
 	}
+	case LitString: {
+		char *litstr = prepareLitString( pd, loc, data.data, data.length(), 
+				length, caseInsensitive );
+		arr = new Key[length];
+		makeFsmKeyArray( arr, litstr, length, pd );
+		delete[] litstr;
+		break;
+	}
+	case HexString: {
+		arr = prepareHexString( pd, loc, data.data, data.length(), length );
+		break;
+	}}
+	return arr;
+}
+
+/* The code point a literal stands for, as written for a utf-8 range: a
+ * non-negative number or a string of one character. Reports an error (unless
+ * report is false) and returns false for anything else that is not a single
+ * byte. */
+bool Literal::codePoint( ParseData *pd, long &cp, bool report )
+{
+	switch ( type ) {
+	case Number: {
+		if ( neg )
+			return false;
+
+		Vector<char> num = data;
+		num.append( 0 );
+
+		errno = 0;
+		if ( num.data[0] == '0' && num.data[1] == 'x' )
+			cp = strtol( num.data, 0, 16 );
+		else
+			cp = strtol( num.data, 0, 10 );
+
+		if ( errno == ERANGE || cp > 0x10ffff ) {
+			if ( report )
+				pd->error(loc) << "literal " << num.data << " is not a code point" << endl;
+			cp = 0x10ffff;
+		}
+		return true;
+	}
+	case LitString: {
+		long length;
+		bool caseInsensitive;
+		char *litstr = prepareLitString( pd, loc, data.data, data.length(), 
+				length, caseInsensitive );
+
+		long pos = 0;
+		cp = length > 0 ? decodeUtf8( litstr, length, pos ) : -1;
+		delete[] litstr;
+
+		if ( cp < 0 || pos != length ) {
+			/* Multiple ascii characters are left for the byte checks. */
+			if ( report && ( pos > 1 || cp < 0 ) )
+				pd->error(loc) << "literal is not a single utf-8 character" << endl;
+			return false;
+		}
+		return true;
+	}
+	case HexString:
+		break;
+	}
+	return false;
 }
 
 /* Evaluate a regular expression object. */
@@ -2015,20 +2436,6 @@ FsmAp *RegExpr::walk( ParseData *pd, RegExpr *rootRegex )
 	return rtnVal;
 }
 
-/* Clean up after an item in a regular expression. */
-ReItem::~ReItem()
-{
-	switch ( type ) {
-		case Data:
-		case Dot:
-			break;
-		case OrBlock:
-		case NegOrBlock:
-			delete orBlock;
-			break;
-	}
-}
-
 /* Evaluate a regular expression object. */
 FsmRes ReItem::walk( ParseData *pd, RegExpr *rootRegex )
 {
@@ -2050,8 +2457,11 @@ FsmRes ReItem::walk( ParseData *pd, RegExpr *rootRegex )
 			break;
 		}
 		case Dot: {
-			/* Make the dot fsm. */
-			rtnVal = FsmAp::dotFsm( pd->fsmCtx );
+			/* Make the dot fsm. In utf-8 mode it is any one character. */
+			if ( pd->id->utf8 && checkUtf8Alphabet( pd, loc ) )
+				rtnVal = makeUtf8RangeFsm( pd, 0, 0x10ffff );
+			else
+				rtnVal = FsmAp::dotFsm( pd->fsmCtx );
 			break;
 		}
 		case OrBlock: {
@@ -2068,7 +2478,10 @@ FsmRes ReItem::walk( ParseData *pd, RegExpr *rootRegex )
 			fsm->minimizePartition2();
 
 			/* Make a dot fsm and subtract from it. */
-			rtnVal = FsmAp::dotFsm( pd->fsmCtx );
+			if ( pd->id->utf8 && checkUtf8Alphabet( pd, loc ) )
+				rtnVal = makeUtf8RangeFsm( pd, 0, 0x10ffff );
+			else
+				rtnVal = FsmAp::dotFsm( pd->fsmCtx );
 			FsmRes res = FsmAp::subtractOp( rtnVal, fsm );
 			rtnVal = res.fsm;
 			rtnVal->minimizePartition2();
@@ -2079,7 +2492,7 @@ FsmRes ReItem::walk( ParseData *pd, RegExpr *rootRegex )
 	/* If the item is followed by a star, then apply the star op. */
 	if ( star ) {
 		if ( rtnVal->startState->isFinState() ) {
-			pd->id->warning(loc) << "applying kleene star to a machine that "
+			pd->warning(loc) << "applying kleene star to a machine that "
 					"accepts zero length word" << endl;
 		}
 
@@ -2091,20 +2504,6 @@ FsmRes ReItem::walk( ParseData *pd, RegExpr *rootRegex )
 	return FsmRes( FsmRes::Fsm(), rtnVal );
 }
 
-/* Clean up after an or block of a regular expression. */
-ReOrBlock::~ReOrBlock()
-{
-	switch ( type ) {
-		case RecurseItem:
-			delete orBlock;
-			delete item;
-			break;
-		case Empty:
-			break;
-	}
-}
-
-
 /* Evaluate an or block of a regular expression. */
 FsmAp *ReOrBlock::walk( ParseData *pd, RegExpr *rootRegex )
 {
@@ -2143,13 +2542,45 @@ FsmAp *ReOrItem::walk( ParseData *pd, RegExpr *rootRegex )
 		/* Put the or data into an array of ints. Note that we find unique
 		 * keys. Duplicates are silently ignored. The alternative would be to
 		 * issue warning or an error but since we can't with [a0-9a] or 'a' |
-		 * 'a' don't bother here. */
+		 * 'a' don't bother here. In utf-8 mode multi-byte characters are
+		 * alternatives of their own rather than bytes of the set. */
+		Vector<char> bytes = data;
+		FsmAp *multi = 0;
+		if ( pd->id->utf8 ) {
+			bytes.empty();
+			for ( long pos = 0; pos < data.length(); ) {
+				long start = pos;
+				long cp = decodeUtf8( data.data, data.length(), pos );
+				if ( cp >= 0 && cp <= 0x7f )
+					bytes.append( data.data[start] );
+				else if ( cp < 0 )
+					pd->error(loc) << "invalid utf-8 in or expression" << endl;
+				else if ( checkUtf8Alphabet( pd, loc ) ) {
+					FsmAp *fsm = makeUtf8RangeFsm( pd, cp, cp );
+					if ( multi == 0 )
+						multi = fsm;
+					else {
+						FsmRes res = FsmAp::unionOp( multi, fsm );
+						multi = res.fsm;
+					}
+				}
+			}
+		}
+
 		KeySet keySet( keyOps );
-		makeFsmUniqueKeyArray( keySet, data.data, data.length(), 
+		makeFsmUniqueKeyArray( keySet, bytes.data, bytes.length(), 
 			rootRegex != 0 ? rootRegex->caseInsensitive : false, pd );
 
 		/* Run the or operator. */
-		rtnVal = FsmAp::orFsm( pd->fsmCtx, keySet.data, keySet.length() );
+		if ( keySet.length() == 0 && multi != 0 )
+			rtnVal = multi;
+		else {
+			rtnVal = FsmAp::orFsm( pd->fsmCtx, keySet.data, keySet.length() );
+			if ( multi != 0 ) {
+				FsmRes res = FsmAp::unionOp( rtnVal, multi );
+				rtnVal = res.fsm;
+			}
+		}
 		break;
 	}
 	case Range: {
@@ -2160,7 +2591,7 @@ FsmAp *ReOrItem::walk( ParseData *pd, RegExpr *rootRegex )
 		/* Validate the range. */
 		if ( keyOps->gt( lowKey, highKey ) ) {
 			/* Recover by setting upper to lower; */
-			pd->id->error(loc) << "lower end of range is greater then upper end" << endl;
+			pd->error(loc) << "lower end of range is greater then upper end" << endl;
 			highKey = lowKey;
 		}
 
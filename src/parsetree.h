@@ -53,6 +53,8 @@ enum BuiltinMachine
 	BT_Empty
 };
 
+#define NUM_BUILTINS ( BT_Empty + 1 )
+
 
 struct ParseData;
 
@@ -75,6 +77,7 @@ struct LongestMatchPart;
 struct LmPartList;
 struct Range;
 struct LengthDef;
+struct LibMachine;
 struct colm_data;
 struct colm_location;
 
@@ -150,6 +153,59 @@ struct ExplicitMachine;
 struct InlineItem;
 struct InlineList;
 
+/*
+ * Bump allocator owning the parse tree of a ParseData. Nodes are placed with
+ * new (pd->arena) and are never deleted individually. Clearing the arena runs
+ * their destructors in reverse order of construction, then frees the blocks.
+ */
+struct ParseArena
+{
+	ParseArena() : block(0), avail(0), left(0), lastHeader(0) {}
+	~ParseArena() { clear(); }
+
+	void *allocate( size_t size, void (*destroy)( void *obj ) );
+	void abandon( void *obj );
+	void clear();
+
+private:
+	/* Precedes every object, linking them for destruction. */
+	struct Header
+	{
+		Header *prev;
+		void (*destroy)( void *obj );
+	};
+
+	struct Block
+	{
+		Block *prev;
+	};
+
+	static const size_t blockSize = 64 * 1024;
+
+	Block *block;
+	char *avail;
+	size_t left;
+	Header *lastHeader;
+};
+
+/* Base of the parse tree nodes. Allocation must go through an arena. */
+template <class T> struct ParseNode
+{
+	static void *operator new( size_t size, ParseArena &arena )
+		{ return arena.allocate( size, &destroy ); }
+
+	/* Called only if the constructor throws. */
+	static void operator delete( void *obj, ParseArena &arena )
+		{ arena.abandon( obj ); }
+
+private:
+	/* Not defined. Nodes are released with their arena. */
+	static void operator delete( void *obj );
+
+	static void destroy( void *obj )
+		{ static_cast<T*>( obj )->~T(); }
+};
+
 /* Reference to a named state. */
 typedef Vector<NameRef*> NameRefList;
 typedef Vector<NameInst*> NameTargList;
@@ -239,11 +295,12 @@ struct PriorityAug
  * A Variable Definition
  */
 struct VarDef
+:
+	public ParseNode<VarDef>
 {
 	VarDef( std::string name, MachineDef *machineDef )
 		: name(name), machineDef(machineDef), isExport(false) { }
 
-	~VarDef();
 
 	/* Parse tree traversal. */
 	FsmRes walk( ParseData *pd );
@@ -357,6 +414,8 @@ struct LongestMatch
 typedef DList<Expression> ExprList;
 
 struct MachineDef
+:
+	public ParseNode<MachineDef>
 {
 	enum Type {
 		JoinType,
@@ -398,6 +457,8 @@ struct MachineDef
  * Join
  */
 struct Join
+:
+	public ParseNode<Join>
 {
 	/* Construct with the first expression. */
 	Join( Expression *expr );
@@ -405,7 +466,8 @@ struct Join
 
 	~Join()
 	{
-		exprList.empty();
+		/* The expressions belong to the arena. */
+		exprList.abandon();
 	}
 
 	/* Tree traversal. */
@@ -423,6 +485,8 @@ struct Join
  * Expression
  */
 struct Expression
+:
+	public ParseNode<Expression>
 {
 	enum Type { 
 		OrType,
@@ -438,6 +502,11 @@ struct Expression
 		expression(expression), term(term), 
 		type(type), prev(this), next(this) { }
 
+	Expression( const InputLoc &loc, Expression *expression,
+			Term *term, Type type ) : 
+		loc(loc), expression(expression), term(term), 
+		type(type), prev(this), next(this) { }
+
 	/* Construct with only a term. */
 	Expression( Term *term ) : 
 		expression(0), term(term),
@@ -448,14 +517,18 @@ struct Expression
 		expression(0), term(0), builtin(builtin), 
 		type(BuiltinType), prev(this), next(this) { }
 
-	~Expression();
 
 	/* Tree traversal. */
 	FsmRes walk( ParseData *pd, bool lastInSeq = true );
+	FsmRes walkOr( ParseData *pd, bool lastInSeq );
+	FsmRes walkNfaFallback( ParseData *pd );
+	FsmRes walkLiteralTrie( ParseData *pd, Vector<Literal*> &lits, bool lastInSeq );
+	bool literalChain( ParseData *pd, Vector<Literal*> &lits );
 	void makeNameTree( ParseData *pd );
 	void resolveNameRefs( ParseData *pd );
 
 	/* Node data. */
+	InputLoc loc;
 	Expression *expression;
 	Term *term;
 	BuiltinMachine builtin;
@@ -470,6 +543,8 @@ typedef Vector<Term*> TermVect;
  * NfaUnion
  */
 struct NfaUnion
+:
+	public ParseNode<NfaUnion>
 {
 	/* Construct with only a term. */
 	NfaUnion() : roundsList(0) { }
@@ -489,7 +564,9 @@ struct NfaUnion
 /*
  * Term
  */
-struct Term 
+struct Term
+:
+	public ParseNode<Term>
 {
 	enum Type { 
 		ConcatType, 
@@ -517,7 +594,6 @@ struct Term
 	Term( FactorWithAug *factorWithAug ) :
 		term(0), factorWithAug(factorWithAug), type(FactorWithAugType) { }
 	
-	~Term();
 
 	FsmRes walk( ParseData *pd, bool lastInSeq = true );
 	void makeNameTree( ParseData *pd );
@@ -539,6 +615,8 @@ struct Term
 
 /* Third level of precedence. Augmenting nodes with actions and priorities. */
 struct FactorWithAug
+:
+	public ParseNode<FactorWithAug>
 {
 	FactorWithAug( FactorWithRep *factorWithRep )
 	:
@@ -572,6 +650,8 @@ struct FactorWithAug
 /* Fourth level of precedence. Trailing unary operators. Provide kleen star,
  * optional and plus. */
 struct FactorWithRep
+:
+	public ParseNode<FactorWithRep>
 {
 	enum Type { 
 		StarType,
@@ -597,7 +677,6 @@ struct FactorWithRep
 		: factorWithNeg(factorWithNeg), type(FactorWithNegType)
 	{}
 
-	~FactorWithRep();
 
 	/* Tree traversal. */
 	FsmRes walk( ParseData *pd );
@@ -617,6 +696,8 @@ struct FactorWithRep
 
 /* Fifth level of precedence. Provides Negation. */
 struct FactorWithNeg
+:
+	public ParseNode<FactorWithNeg>
 {
 	enum Type { 
 		NegateType, 
@@ -630,7 +711,6 @@ struct FactorWithNeg
 	FactorWithNeg( Factor *factor ) :
 		factorWithNeg(0), factor(factor), type(FactorType) { }
 
-	~FactorWithNeg();
 
 	/* Tree traversal. */
 	FsmRes walk( ParseData *pd );
@@ -647,6 +727,8 @@ struct FactorWithNeg
  * Factor
  */
 struct Factor
+:
+	public ParseNode<Factor>
 {
 	/* Language elements a factor node can be. */
 	enum Type {
@@ -660,7 +742,8 @@ struct Factor
 		NfaRep,
 		NfaWrap,
 		CondStar,
-		CondPlus
+		CondPlus,
+		LibraryType
 	}; 
 
 	enum NfaRepeatMode {
@@ -697,6 +780,11 @@ struct Factor
 	Factor( LongestMatch *longestMatch ) :
 		longestMatch(longestMatch), type(LongestMatchType) {}
 
+	/* Construct with a machine loaded from a library. */
+	Factor( const InputLoc &loc, LibMachine *libMachine ) :
+		loc(loc), libMachine(libMachine), libActions(0),
+		libPriorDescs(0), type(LibraryType) {}
+
 	Factor( const InputLoc &loc, long long repId, Expression *expression, 
 			Action *action1, Action *action2, Action *action3,
 			Action *action4, Action *action5, Action *action6, Type type )
@@ -723,6 +811,9 @@ struct Factor
 	VarDef *varDef;
 	Join *join;
 	LongestMatch *longestMatch;
+	LibMachine *libMachine;
+	Action **libActions;
+	PriorDesc *libPriorDescs;
 	int lower, upper;
 	long repId;
 	Expression *expression;
@@ -740,11 +831,12 @@ struct Factor
 
 /* A range machine. Only ever composed of two literals. */
 struct Range
+:
+	public ParseNode<Range>
 {
 	Range( Literal *lowerLit, Literal *upperLit, bool caseIndep ) 
 		: lowerLit(lowerLit), upperLit(upperLit), caseIndep(caseIndep) { }
 
-	~Range();
 	FsmAp *walk( ParseData *pd );
 
 	Literal *lowerLit;
@@ -754,6 +846,8 @@ struct Range
 
 /* Some literal machine. Can be a number or literal string. */
 struct Literal
+:
+	public ParseNode<Literal>
 {
 	enum LiteralType { Number, LitString, HexString };
 
@@ -764,6 +858,8 @@ struct Literal
 	}
 
 	FsmAp *walk( ParseData *pd );
+	Key *makeKeys( ParseData *pd, long &length, bool &caseInsensitive );
+	bool codePoint( ParseData *pd, long &cp, bool report = true );
 	
 	InputLoc loc;
 	bool neg;
@@ -773,6 +869,8 @@ struct Literal
 
 /* Regular expression. */
 struct RegExpr
+:
+	public ParseNode<RegExpr>
 {
 	enum RegExpType { RecurseItem, Empty };
 
@@ -783,7 +881,6 @@ struct RegExpr
 		regExpr(regExpr), item(item), 
 		type(RecurseItem), caseInsensitive(false) { }
 
-	~RegExpr();
 	FsmAp *walk( ParseData *pd, RegExpr *rootRegex );
 
 	RegExpr *regExpr;
@@ -794,6 +891,8 @@ struct RegExpr
 
 /* An item in a regular expression. */
 struct ReItem
+:
+	public ParseNode<ReItem>
 {
 	enum ReItemType { Data, Dot, OrBlock, NegOrBlock };
 	
@@ -810,7 +909,6 @@ struct ReItem
 	ReItem( const InputLoc &loc, ReOrBlock *orBlock, ReItemType type )
 		: loc(loc), orBlock(orBlock), star(false), type(type) { }
 
-	~ReItem();
 	FsmRes walk( ParseData *pd, RegExpr *rootRegex );
 
 	InputLoc loc;
@@ -822,6 +920,8 @@ struct ReItem
 
 /* An or block item. */
 struct ReOrBlock
+:
+	public ParseNode<ReOrBlock>
 {
 	enum ReOrBlockType { RecurseItem, Empty };
 
@@ -831,7 +931,6 @@ struct ReOrBlock
 	ReOrBlock(ReOrBlock *orBlock, ReOrItem *item)
 		: orBlock(orBlock), item(item), type(RecurseItem) { }
 
-	~ReOrBlock();
 	FsmAp *walk( ParseData *pd, RegExpr *rootRegex );
 	
 	ReOrBlock *orBlock;
@@ -841,6 +940,8 @@ struct ReOrBlock
 
 /* An item in an or block. */
 struct ReOrItem
+:
+	public ParseNode<ReOrItem>
 {
 	enum ReOrItemType { Data, Range };
 
@@ -49,10 +49,10 @@ void TopLevel::loadMachineName( string data )
 void TopLevel::tryMachineDef( const InputLoc &loc, std::string name, 
 		MachineDef *machineDef, bool isInstance )
 {
-	GraphDictEl *newEl = pd->graphDict.insert( name );
+	GraphDictEl *newEl = pd->insertGraph( name );
 	if ( newEl != 0 ) {
 		/* New element in the dict, all good. */
-		newEl->value = new VarDef( name, machineDef );
+		newEl->value = new (pd->arena) VarDef( name, machineDef );
 		newEl->isInstance = isInstance;
 		newEl->loc = loc;
 		newEl->value->isExport = exportContext[exportContext.length()-1];
@@ -112,15 +112,8 @@ void TopLevel::include( const InputLoc &incLoc, bool fileSpecified, string fileN
 	/* Build the include checks. */
 	if ( fileSpecified )
 		includeChecks = pd->id->makeIncludePathChecks( curFileName, fileName.c_str() );
-	else {
-		char *test = new char[strlen(curFileName)+1];
-		strcpy( test, curFileName );
-
-		includeChecks = new const char*[2];
-
-		includeChecks[0] = test;
-		includeChecks[1] = 0;
-	}
+	else
+		includeChecks = pd->id->makeFileChecks( curFileName );
 
 	/* Try to find the file. */
 	ifstream *inFile = pd->id->tryOpenInclude( includeChecks, found );
@@ -176,13 +169,13 @@ void TopLevel::include( const InputLoc &incLoc, bool fileSpecified, string fileN
 
 void TopLevel::import( const InputLoc &loc, std::string name, Literal *literal )
 {
-	MachineDef *machineDef = new MachineDef(
-			new Join(
-				new Expression(
-					new Term(
-						new FactorWithAug(
-							new FactorWithRep(
-								new FactorWithNeg( new Factor( literal ) )
+	MachineDef *machineDef = new (pd->arena) MachineDef(
+			new (pd->arena) Join(
+				new (pd->arena) Expression(
+					new (pd->arena) Term(
+						new (pd->arena) FactorWithAug(
+							new (pd->arena) FactorWithRep(
+								new (pd->arena) FactorWithNeg( new (pd->arena) Factor( literal ) )
 								)
 							)
 						)
@@ -38,6 +38,7 @@ using std::ostream;
 
 extern char *Parser6_lelNames[];
 struct Section;
+struct ImportResult;
 
 struct Scanner
 {
@@ -52,6 +53,7 @@ struct Scanner
 		includeDepth(includeDepth),
 		importMachines(importMachines),
 		cur_token(0),
+		importRecord(0),
 		line(1), column(1), lastnl(0), 
 		parser(0), ignoreSection(false), 
 		parserExistsError(false),
@@ -100,6 +102,10 @@ struct Scanner
 	char *token_strings[max_tokens];
 	int token_lens[max_tokens];
 
+	/* Tokens passed on by an import scan, kept for later imports of the same
+	 * file. */
+	ImportResult *importRecord;
+
 	/* For section processing. */
 	int cs;
 	char *word, *lit;
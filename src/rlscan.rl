@@ -192,6 +192,9 @@ void Scanner::directToParser( Parser6 *toParser, const char *tokFileName, int to
 
 void Scanner::importToken( int token, char *start, char *end )
 {
+	if ( importRecord != 0 )
+		importRecord->append( token, start, end );
+
 	if ( cur_token == max_tokens )
 		flushImport();
 
@@ -220,7 +223,7 @@ void Scanner::pass()
 	/* If no errors and we are at the bottom of the include stack (the
 	 * source file listed on the command line) then write out the data. */
 	if ( includeDepth == 0 && id->machineSpec == 0 && id->machineName == 0 )
-		id->curItem->data.write( ts, te-ts );
+		id->appendHostData( id->curItem, ts, te-ts, -1 );
 }
 
 void Scanner::pass( int token, char *start, char *end )
@@ -350,19 +353,12 @@ void Scanner::handleInclude()
 		if ( lit != 0 ) {
 			long length = 0;
 			bool caseInsensitive = false;
-			char *data = prepareLitString( id, InputLoc(), lit, lit_len, length, caseInsensitive );
+			char *data = prepareLitString( parser->pd, InputLoc(), lit, lit_len, length, caseInsensitive );
 
 			includeChecks = parser->pd->id->makeIncludePathChecks( fileName, data );
 		}
-		else {
-			char *test = new char[strlen(fileName)+1];
-			strcpy( test, fileName );
-
-			includeChecks = new const char*[2];
-
-			includeChecks[0] = test;
-			includeChecks[1] = 0;
-		}
+		else
+			includeChecks = parser->pd->id->makeFileChecks( fileName );
 
 		long found = 0;
 		ifstream *inFile = parser->pd->id->tryOpenInclude( includeChecks, found );
@@ -396,7 +392,7 @@ void Scanner::handleImport()
 	if ( active() ) {
 		long length = 0;
 		bool caseInsensitive = false;
-		char *data = prepareLitString( id, InputLoc(), lit, lit_len, length, caseInsensitive );
+		char *data = prepareLitString( parser->pd, InputLoc(), lit, lit_len, length, caseInsensitive );
 
 		const char **importChecks = parser->pd->id->makeIncludePathChecks( fileName, data );
 
@@ -409,11 +405,29 @@ void Scanner::handleImport()
 			const char **tried = importChecks;
 			while ( *tried != 0 )
 				id->error(scan_loc()) << "import: attempted: \"" << *tried++ << '\"' << endl;
+			return;
 		}
 
 		Scanner scanner( id, importChecks[found], *inFile, parser,
 				0, includeDepth+1, true );
-		scanner.do_scan( );
+
+		/* Sections are ignored in an import, so the tokens are all a scan
+		 * produces. If the file was scanned before, replay them. */
+		ImportResult *cached = id->findImport( importChecks[found] );
+		if ( cached != 0 ) {
+			for ( std::vector<ImportResult::Token>::iterator tok = cached->tokens.begin();
+					tok != cached->tokens.end(); tok++ )
+			{
+				char *start = tok->hasData ? &tok->data[0] : 0;
+				scanner.importToken( tok->type, start, start + tok->data.size() );
+			}
+		}
+		else {
+			scanner.importRecord = id->newImport( importChecks[found] );
+			scanner.do_scan( );
+			scanner.importRecord = 0;
+		}
+
 		scanner.importToken( 0, 0, 0 );
 		scanner.flushImport();
 		delete inFile;
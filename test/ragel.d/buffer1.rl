@@ -0,0 +1,82 @@
+/*
+ * @LANG: c
+ *
+ * A scanner fed from a file through the buffer of write buffer. The input is
+ * many times the size of the buffer, so tokens are cut where it wraps.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+%%{
+	machine buffer1;
+
+	main := |*
+		[a-z]+ => { words += 1; chars += te - ts; };
+		[0-9]+ => { numbers += 1; chars += te - ts; };
+		' ' | '\n';
+	*|;
+}%%
+
+%% write data;
+%% write buffer;
+
+int main()
+{
+	struct buffer1_buffer b;
+	FILE *f = tmpfile();
+	int fd, cs, act;
+	char *p, *pe, *ts, *te, *eof = 0;
+	long i, len, words = 0, numbers = 0, chars = 0;
+
+	for ( i = 0; i < 3000; i++ )
+		fprintf( f, "word%ld %ld abc\n", i, i * 7 );
+	fflush( f );
+	fd = fileno( f );
+	lseek( fd, 0, SEEK_SET );
+
+	if ( buffer1_buffer_open( &b, 4096 ) != 0 ) {
+		printf( "OPEN FAILED\n" );
+		return 1;
+	}
+
+	%% write init;
+	p = pe = b.data;
+	te = 0;
+
+	while ( 1 ) {
+		len = buffer1_buffer_read( &b, fd, &p, &pe, &ts, &te );
+		if ( len < 0 ) {
+			printf( "READ FAILED\n" );
+			break;
+		}
+		if ( len == 0 )
+			eof = pe;
+
+		%% write exec;
+
+		if ( cs == buffer1_error ) {
+			printf( "FAIL\n" );
+			break;
+		}
+		if ( len == 0 )
+			break;
+	}
+
+	printf( "words: %ld\n", words );
+	printf( "numbers: %ld\n", numbers );
+	printf( "chars: %ld\n", chars );
+
+	buffer1_buffer_close( &b );
+	fclose( f );
+	(void)act;
+	return 0;
+}
+
+##### OUTPUT #####
+words: 6000
+numbers: 6000
+chars: 45301
@@ -0,0 +1,161 @@
+/*
+ * @LANG: c
+ * @RAGEL_FLAGS: --codegen-jobs=4
+ *
+ * Six machines built on four threads, so in two batches. The output must be
+ * what the serial generation gives.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+int n, len, depth;
+
+%%{
+	machine numbers;
+	main := ( [0-9]+ >{ n = 0; } ${ n = n * 10 + ( fc - '0' ); }
+			%{ printf( "num %d\n", n ); } ' ' )*;
+}%%
+
+%% write data;
+
+void run_numbers( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	printf( "%s\n", cs >= numbers_first_final ? "ACCEPT" : "FAIL" );
+}
+
+%%{
+	machine idents;
+	main := ( [a-z]+ >{ len = 0; } ${ len++; }
+			%{ printf( "ident %d\n", len ); } ' ' )*;
+}%%
+
+%% write data;
+
+void run_idents( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	printf( "%s\n", cs >= idents_first_final ? "ACCEPT" : "FAIL" );
+}
+
+%%{
+	machine keywords;
+	main := ( 'if' @{ printf( "if\n" ); } |
+			'else' @{ printf( "else\n" ); } | ' ' )*;
+}%%
+
+%% write data;
+
+void run_keywords( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	printf( "%s\n", cs >= keywords_first_final ? "ACCEPT" : "FAIL" );
+}
+
+%%{
+	machine hex;
+	main := '0x' [0-9a-f]+ '\n';
+}%%
+
+%% write data;
+
+void run_hex( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	printf( "%s\n", cs >= hex_first_final ? "ACCEPT" : "FAIL" );
+}
+
+%%{
+	machine tokens;
+	main := |*
+		[a-z]+ => { printf( "tok %d\n", (int)( te - ts ) ); };
+		[0-9]+ => { printf( "int %d\n", (int)( te - ts ) ); };
+		' ';
+	*|;
+}%%
+
+%% write data;
+
+void run_tokens( const char *data )
+{
+	int cs, act;
+	const char *ts, *te;
+	const char *p = data, *pe = data + strlen( data ), *eof = pe;
+
+	%% write init;
+	%% write exec;
+
+	printf( "%s\n", cs != tokens_error ? "ACCEPT" : "FAIL" );
+	(void)act;
+}
+
+%%{
+	machine parens;
+	main := ( '(' @{ depth++; } | ')' @{ depth--; } )*;
+}%%
+
+%% write data;
+
+void run_parens( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	depth = 0;
+	%% write init;
+	%% write exec;
+
+	printf( "depth %d\n", depth );
+}
+
+int main()
+{
+	run_numbers( "12 345 " );
+	run_idents( "ab cde " );
+	run_keywords( "if else if" );
+	run_hex( "0x1f\n" );
+	run_hex( "0x\n" );
+	run_tokens( "abc 12 de" );
+	run_parens( "(()(" );
+	return 0;
+}
+
+##### OUTPUT #####
+num 12
+num 345
+ACCEPT
+ident 2
+ident 3
+ACCEPT
+if
+else
+if
+ACCEPT
+ACCEPT
+FAIL
+tok 3
+int 2
+tok 2
+ACCEPT
+depth 2
@@ -15,10 +15,13 @@ int _perf_dummy = 0;
 #define perf_printf(...) ( _perf_dummy += 1 )
 #define perf_loop long _pi; for ( _pi = 0; _pi < perf_iters; _pi++ )
 
+#include "perfbytes.h"
+
 #else
 
 #define perf_printf(...) printf( __VA_ARGS__ )
 #define perf_loop
+#define perf_count( n )
 
 #endif
 
@@ -145,6 +148,7 @@ int Scanner::execute( const char *data, int len )
 {
 	perf_loop
 	{
+		perf_count( len );
 		Scanner *fsm = this;
 
 		/* A count of the number of characters in 
@@ -0,0 +1,100 @@
+/*
+ * @LANG: c
+ *
+ * Write exec_lazy accepts if any alternative of the union does. The second
+ * machine has more dfa states than the cache holds, so the cache is flushed
+ * during a run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+%%{
+	machine execlazy;
+
+	main |= (1, 0)
+		( 'ab' [0-9]+ 'x' ) |
+		( 'a' [a-z]+ 'y' ) |
+		( [a-z]+ 'cz' );
+}%%
+
+%% write data;
+
+void test( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec_lazy;
+
+	if ( cs >= execlazy_first_final )
+		printf( "ACCEPT\n" );
+	else if ( cs == execlazy_error )
+		printf( "FAIL at %d\n", (int)( p - data ) );
+	else
+		printf( "MORE\n" );
+}
+
+%%{
+	machine fourth;
+
+	main |= (1, 0)
+		( any* 'a' any{3} ) | ( any* 'b' any{3} ) | ( any* 'c' any{3} ) |
+		( any* 'd' any{3} ) | ( any* 'e' any{3} ) | ( any* 'f' any{3} ) |
+		( any* 'g' any{3} ) | ( any* 'h' any{3} ) | ( any* 'i' any{3} ) |
+		( any* 'j' any{3} ) | ( any* 'k' any{3} );
+}%%
+
+%% write data;
+
+/* Accepts if the fourth character from the end is one of a to k. */
+int fourth( const char *data, long len )
+{
+	int cs;
+	const char *p = data, *pe = data + len;
+
+	%% write init;
+	%% write exec_lazy;
+
+	return cs >= fourth_first_final;
+}
+
+int main()
+{
+	long len = 20000, i;
+	char *data = (char*) malloc( len );
+	unsigned int seed = 1;
+	int mismatches = 0;
+
+	test( "ab12x" );
+	test( "abcy" );
+	test( "abccz" );
+	test( "ab1" );
+	test( "ab1q" );
+	test( "9" );
+
+	for ( i = 0; i < len; i++ ) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = 'a' + ( seed >> 16 ) % 12;
+	}
+
+	for ( i = len; i > len - 20; i-- ) {
+		if ( fourth( data, i ) != ( i >= 4 && data[i - 4] <= 'k' ) )
+			mismatches += 1;
+	}
+	printf( "mismatches: %d\n", mismatches );
+
+	free( data );
+	return 0;
+}
+
+##### OUTPUT #####
+ACCEPT
+ACCEPT
+ACCEPT
+MORE
+FAIL at 3
+FAIL at 0
+mismatches: 0
@@ -0,0 +1,80 @@
+/*
+ * @LANG: c
+ *
+ * Write exec_parallel must end in the same state as write exec, over buffers
+ * of several chunks. Without OpenMP the chunks run in turn.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+%%{
+	machine execpar;
+
+	main := ( 'a' [0-9]* ';' | 'b'+ ';' )*;
+}%%
+
+%% write data;
+
+int run_serial( const char *data, long len )
+{
+	int cs;
+	const char *p = data, *pe = data + len;
+
+	%% write init;
+	%% write exec;
+
+	return cs;
+}
+
+int run_parallel( const char *data, long len )
+{
+	int cs;
+	const char *p = data, *pe = data + len;
+
+	%% write init;
+	%% write exec_parallel;
+
+	return cs;
+}
+
+void test( const char *data, long len )
+{
+	int serial = run_serial( data, len );
+	int parallel = run_parallel( data, len );
+
+	if ( serial != parallel )
+		printf( "MISMATCH\n" );
+	else if ( serial >= execpar_first_final )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+int main()
+{
+	long len = 9 * 350000;
+	char *data = (char*) malloc( len );
+	long i;
+
+	for ( i = 0; i < len; i++ )
+		data[i] = "a12;bb;a;"[i % 9];
+
+	test( data, len );
+	test( data, len - 1 );
+	test( data, len - 3 );
+	data[2 * 1048576 + 17] = 'x';
+	test( data, len );
+	test( data, 0 );
+
+	free( data );
+	return 0;
+}
+
+##### OUTPUT #####
+ACCEPT
+FAIL
+FAIL
+FAIL
+ACCEPT
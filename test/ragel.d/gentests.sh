@@ -8,6 +8,14 @@
 #
 #    @RAGEL_FILE: file name to pass on the command line instead of file created
 #    by extracting section. Does not work with translated test cases.
+#
+#    @RAGEL_FLAGS: options added to every ragel command line of the test case.
+#
+#    @EXPECT_CODE: grep pattern that must match the generated code. A miss is
+#    added to the output, so the test fails on the diff.
+#
+#    @LIBRARY: ragel file compiled with --write-library before each run of the
+#    test case. The library is loaded into the test case with --load-library.
 # 
 
 TRANS=./trans
@@ -317,9 +325,18 @@ function run_test()
 	classfile=$wk/`echo $lroot$gen_opt.class | sed 's/-\+/_/g'`
 	classname=`echo $lroot$gen_opt | sed 's/-\+/_/g'`
 
-	opts="$gen_opt $min_opt $enc_opt $f_opt"
+	library=$wk/`echo $lroot$gen_opt.rlib | sed 's/-\+/_/g'`
+
+	opts="$gen_opt $min_opt $enc_opt $f_opt $case_ragel_flags"
+	[ -n "$LIBRARY" ] && opts="$opts --load-library=$library"
 	args="-I. $opts -o $code_src $translated"
 
+	if [ -n "$LIBRARY" ]; then
+		cat >> $sh <<-EOF
+		$host_ragel -I. --write-library=$library -o $library.$code_suffix $LIBRARY
+		EOF
+	fi
+
 	cat >> $sh <<-EOF
 	echo testing $lroot $opts
 	$host_ragel $args
@@ -353,6 +370,12 @@ function run_test()
 		$exec_cmd 2>> $log >> $output
 		EOF
 
+		if [ -n "$EXPECT_CODE" ]; then
+			cat >> $sh <<-EOF
+			grep -q -e '$EXPECT_CODE' $code_src || echo "no match: $EXPECT_CODE" >> $output
+			EOF
+		fi
+
 		cat >> $sh <<-EOF
 		diff -u --strip-trailing-cr $expected_out $output > $diff
 		# rm -f $intermed $code_src $binary $classfile $output 
@@ -416,6 +439,15 @@ function run_translate()
 	# Filter to pass output through. Shell code.
 	FILTER=`sed '/@FILTER:/s/^.*: *//p;d' $test_case`
 
+	# Options for ragel itself.
+	case_ragel_flags=`sed '/@RAGEL_FLAGS:/s/^.*: *//p;d' $test_case`
+
+	# Pattern the generated code must contain.
+	EXPECT_CODE=`sed '/@EXPECT_CODE:/s/^.*: *//p;d' $test_case`
+
+	# Library to build first.
+	LIBRARY=`sed '/@LIBRARY:/s/^.*: *//p;d' $test_case`
+
 	# If the test case has a directory by the same name, copy it into the
 	# working direcotory.
 	if [ -d $root ]; then
@@ -0,0 +1,57 @@
+/*
+ * @LANG: c
+ * @LIBRARY: library2/tokens.rl
+ *
+ * Machines loaded from a library keep their actions and priorities. The
+ * keyword priority is named in both specs, so a keyword still leaves without
+ * the ident action.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+int n;
+
+%%{
+	machine library2;
+
+	keyword = ( 'if' | 'int' ) %(kw, 1) %{ printf( "keyword\n" ); };
+
+	main := ( ( number | ident | keyword ) ' ' )*;
+}%%
+
+%% write data;
+
+void test( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	if ( cs >= library2_first_final )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+int main()
+{
+	test( "if iff 12 int x " );
+	test( "7 in " );
+	test( "if2 " );
+	return 0;
+}
+
+##### OUTPUT #####
+keyword
+ident
+number 12
+keyword
+ident
+ACCEPT
+number 7
+ident
+ACCEPT
+FAIL
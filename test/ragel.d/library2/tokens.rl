@@ -0,0 +1,15 @@
+/*
+ * Library of token machines for library2.rl. The actions use the variable n
+ * of the spec that loads them.
+ */
+
+%%{
+	machine tokens;
+
+	export number = [0-9]+
+			>{ n = 0; }
+			${ n = n * 10 + ( fc - '0' ); }
+			%{ printf( "number %d\n", n ); };
+
+	export ident = [a-z]+ %(kw, 0) %{ printf( "ident\n" ); };
+}%%
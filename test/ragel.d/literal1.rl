@@ -0,0 +1,63 @@
+/*
+ * @LANG: indep
+ *
+ * A long union of literals is built as a trie. Prefixes, shared suffixes and
+ * case-insensitive literals must match as they do in a plain union.
+ */
+%%{
+	machine literal1;
+
+	main := (
+		'while' | 'when' | 'then' | 'where' | 'if' | 'else' | 'el' | 'elif' |
+		'for' | 'in' | 'select'i | 'from'i | 'when'i | 64
+	) '\n';
+}%%
+
+##### INPUT #####
+"while\n"
+"when\n"
+"WHEN\n"
+"wHeN\n"
+"then\n"
+"THEN\n"
+"where\n"
+"wher\n"
+"if\n"
+"el\n"
+"else\n"
+"elif\n"
+"eli\n"
+"for\n"
+"FOR\n"
+"in\n"
+"select\n"
+"SeLeCt\n"
+"from\n"
+"FROM\n"
+"@\n"
+"x\n"
+"\n"
+##### OUTPUT #####
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+FAIL
+ACCEPT
+FAIL
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+FAIL
+ACCEPT
+FAIL
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+ACCEPT
+FAIL
+FAIL
@@ -19,10 +19,13 @@ int _perf_dummy = 0;
 #define perf_printf(...) ( _perf_dummy += 1 )
 #define perf_loop long _pi; for ( _pi = 0; _pi < perf_iters; _pi++ )
 
+#include "perfbytes.h"
+
 #else
 
 #define perf_printf(...) printf( __VA_ARGS__ )
 #define perf_loop
+#define perf_count( n )
 
 #endif
 
@@ -112,6 +115,7 @@ void MBox::execute( const char *data, int len )
 {
 	perf_loop
 	{
+		perf_count( len );
 		const char *p = data;
 		const char *pe = data + len;
 		%%{
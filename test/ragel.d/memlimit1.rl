@@ -0,0 +1,77 @@
+/*
+ * @LANG: c
+ * @RAGEL_FLAGS: --memory-limit=256k
+ * @EXPECT_CODE: nfa_bp\[nfa_len\]
+ * @FILTER: LC_ALL=C sort
+ *
+ * A union of counters whose DFA needs a state for every combination, 30030 of
+ * them. That is over the memory limit, so the alternatives are joined with an
+ * NFA union instead. Every alternative that matches reports itself.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+struct nfa_bp_rec
+{
+	long state;
+	const char *p;
+	int pop;
+};
+
+struct nfa_bp_rec nfa_bp[1024];
+long nfa_len = 0;
+long nfa_count = 0;
+
+%%{
+	machine memlimit1;
+
+	action m2 { printf( "%d of 2\n", n ); fnext *memlimit1_error; }
+	action m3 { printf( "%d of 3\n", n ); fnext *memlimit1_error; }
+	action m5 { printf( "%d of 5\n", n ); fnext *memlimit1_error; }
+	action m7 { printf( "%d of 7\n", n ); fnext *memlimit1_error; }
+	action m11 { printf( "%d of 11\n", n ); fnext *memlimit1_error; }
+	action m13 { printf( "%d of 13\n", n ); fnext *memlimit1_error; }
+
+	main :=
+		( 'a'{2} )* '\n' @m2 |
+		( 'a'{3} )* '\n' @m3 |
+		( 'a'{5} )* '\n' @m5 |
+		( 'a'{7} )* '\n' @m7 |
+		( 'a'{11} )* '\n' @m11 |
+		( 'a'{13} )* '\n' @m13;
+}%%
+
+%% write data;
+
+char buf[256];
+
+void test( int n )
+{
+	int cs;
+	const char *p = buf, *pe = buf + n + 1, *eof = pe;
+
+	memset( buf, 'a', n );
+	buf[n] = '\n';
+
+	%% write init;
+	%% write exec;
+}
+
+int main()
+{
+	test( 30 );
+	test( 77 );
+	test( 1 );
+	test( 143 );
+	return 0;
+}
+
+##### OUTPUT #####
+143 of 11
+143 of 13
+30 of 2
+30 of 3
+30 of 5
+77 of 11
+77 of 7
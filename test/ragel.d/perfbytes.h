@@ -0,0 +1,28 @@
+#ifndef _PERFBYTES_H
+#define _PERFBYTES_H
+
+/* Bytes fed to the machine in PERF_TEST builds. The total is printed on
+ * stderr at exit, for the throughput column of perfmatrix. Works in C and
+ * C++ cases. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static long long _perf_bytes = 0;
+static int _perf_reporting = 0;
+
+static void _perf_report( void )
+{
+	fprintf( stderr, "perf-bytes: %lld\n", _perf_bytes );
+}
+
+static void perf_count( long long n )
+{
+	if ( !_perf_reporting ) {
+		atexit( _perf_report );
+		_perf_reporting = 1;
+	}
+	_perf_bytes += n;
+}
+
+#endif
@@ -0,0 +1,205 @@
+#!/bin/bash
+#
+# Runtime benchmark matrix. Every test case that has a PERF_TEST build is
+# generated in each code style by each host ragel that can emit its language,
+# then compiled and timed.
+#
+#   perfmatrix [-s seconds] [-b baseline] [-t percent] [cases...]
+#
+#   -s   Scale of the perf loops, roughly seconds per run (default 1).
+#   -b   Table from a previous run to compare against.
+#   -t   Throughput loss, in percent, counted as a regression (default 10).
+#
+# Prints one tab separated row per combination:
+#
+#   case  host  style  code-bytes  compile-secs  run-secs  mb-per-sec
+#
+# A combination that fails to generate, compile or run has "-" in the
+# remaining columns, is reported on stderr with its error file and makes the
+# exit status 1. With -b, rows that lose more than the threshold against the
+# baseline are also reported on stderr and make the exit status 1.
+#
+
+export RAGEL_BIN="@SUBJ_RAGEL_BIN@"
+export RAGEL_C_BIN="@SUBJ_RAGEL_C_BIN@"
+
+cxx_compiler="@CXX@"
+c_compiler="@CC@"
+
+# Code styles, as listed in ragel --help.
+styles="-T0 -T1 -F0 -F1 -G0 -G1 -G2"
+
+CFLAGS="-O3 -Wall -Wno-unused-but-set-variable -Wno-unused-variable"
+
+seconds=1
+baseline=""
+threshold=10
+
+while getopts "s:b:t:" opt; do
+	case $opt in
+		s) seconds=$OPTARG ;;
+		b) baseline=$OPTARG ;;
+		t) threshold=$OPTARG ;;
+		?) exit 1 ;;
+	esac
+done
+
+shift $((OPTIND - 1));
+
+[ -z "$*" ] && set -- `grep -l '^#ifdef PERF_TEST' *.rl`
+
+wk=working-perf
+test -d $wk || mkdir $wk
+
+# Host ragels that can emit a language.
+function lang_hosts()
+{
+	case $1 in
+		c|c++) echo "ragel ragel-c ragel-c-var" ;;
+	esac
+}
+
+function host_opts()
+{
+	host=$1
+	lang=$2
+
+	case $host in
+		ragel)
+			host_ragel=$RAGEL_BIN
+			host_flag=""
+			host_prohibit=""
+		;;
+		ragel-c)
+			host_ragel=$RAGEL_C_BIN
+			host_flag=""
+			host_prohibit=""
+		;;
+		ragel-c-var)
+			host_ragel="$RAGEL_C_BIN --var-backend"
+			host_flag="--var-backend"
+			host_prohibit="-G0 -G1 -G2"
+		;;
+	esac
+
+	case $lang in
+		c)
+			compiler=$c_compiler
+			code_suffix=c
+		;;
+		c++)
+			compiler=$cxx_compiler
+			code_suffix=cpp
+		;;
+	esac
+}
+
+function now()
+{
+	date +%s.%N
+}
+
+function bench()
+{
+	root=$1
+	host=$2
+	style=$3
+
+	stem=$wk/`echo ${root}_${host}$style | sed 's/-\+/_/g'`
+	code_src=$stem.$code_suffix
+	binary=$stem.bin
+	err=$stem.err
+
+	printf "%s\t%s\t%s" $root $host $style
+
+	if ! $host_ragel -I. $style -o $code_src $root.rl 2>$err; then
+		printf "\t-\t-\t-\t-\n"
+		echo "failed: $root $host $style: generate, see $err" >&2
+		return
+	fi
+
+	size=`wc -c < $code_src`
+
+	start=`now`
+	if ! $compiler $CFLAGS -DPERF_TEST -DS=${seconds}ll -I. \
+			-o $binary $code_src 2>$err; then
+		printf "\t%d\t-\t-\t-\n" $size
+		echo "failed: $root $host $style: compile, see $err" >&2
+		return
+	fi
+	end=`now`
+	compile=`awk "BEGIN { printf( \"%.3f\", $end - $start ); }"`
+
+	TIMEFORMAT=%U
+	run=`{ time ./$binary > /dev/null 2>$err; } 2>&1`
+	status=$?
+	bytes=`sed -n 's/^perf-bytes: //p' $err`
+
+	if [ $status != 0 ] || [ -z "$bytes" ]; then
+		printf "\t%d\t%s\t-\t-\n" $size $compile
+		echo "failed: $root $host $style: run, see $err" >&2
+		return
+	fi
+
+	mbs=`awk "BEGIN { if ( $run > 0 ) printf( \"%.2f\", $bytes / $run / 1000000 ); else print \"-\"; }"`
+	printf "\t%d\t%s\t%s\t%s\n" $size $compile $run $mbs
+}
+
+function matrix()
+{
+	for test_case; do
+		root=`basename $test_case`
+		root=${root%.rl}
+
+		lang=`sed '/@LANG:/s/^.*: *//p;d' $test_case`
+		case_prohibit=`sed '/@PROHIBIT_FLAGS:/s/^.*: *//p;d' $test_case`
+
+		for host in `lang_hosts $lang`; do
+			host_opts $host $lang
+			[ -z "$compiler" ] && continue
+
+			# The case may rule out a whole host by its flag, eg
+			# --var-backend. Styles are checked one by one below.
+			if [ -n "$host_flag" ]; then
+				echo " $case_prohibit " | grep -qe " $host_flag " && continue
+			fi
+
+			for style in $styles; do
+				echo " $host_prohibit $case_prohibit " | grep -qe " $style " && continue
+				bench $root $host $style
+			done
+		done
+	done
+}
+
+table=$wk/table
+matrix "$@" | tee $table
+
+# Every failed combination has no run time.
+failed=`awk -F '\t' '$6 == "-"' $table | wc -l`
+status=0
+[ $failed != 0 ] && status=1
+
+[ -z "$baseline" ] && exit $status
+
+# Compare throughput against the baseline, keyed on case, host and style.
+awk -v threshold=$threshold -F '\t' '
+	NR == FNR {
+		if ( $7 != "-" )
+			base[$1 "\t" $2 "\t" $3] = $7;
+		next;
+	}
+	{
+		key = $1 "\t" $2 "\t" $3;
+		if ( !( key in base ) )
+			next;
+		if ( $7 == "-" || $7 < base[key] * ( 1 - threshold / 100 ) ) {
+			printf( "regression: %s %s %s: %s -> %s MB/s\n",
+					$1, $2, $3, base[key], $7 ) > "/dev/stderr";
+			failed = 1;
+		}
+	}
+	END { exit failed; }
+' $baseline $table || status=1
+
+exit $status
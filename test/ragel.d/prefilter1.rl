@@ -0,0 +1,88 @@
+/*
+ * @LANG: c
+ * @RAGEL_FLAGS: --prefilter
+ *
+ * The start state loops on everything but 'x', so write exec skips ahead to
+ * each 'x' with memchr. The matches must be the same as without the skip,
+ * across windows of the buffer, and noend must be left alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+%%{
+	machine prefilter;
+
+	action hit {
+		hits += 1;
+		if ( hits == limit )
+			fbreak;
+	}
+
+	main := any* 'xy' @hit;
+}%%
+
+%% write data;
+
+int count( char *data, long len )
+{
+	int cs, hits = 0, limit = -1;
+	char *p = data, *pe = data + len;
+
+	%% write init;
+	%% write exec;
+
+	if ( p != pe )
+		printf( "STOPPED EARLY\n" );
+	return hits;
+}
+
+int count_noend( char *data, int limit )
+{
+	int cs, hits = 0;
+	char *p = data;
+
+	%% write init;
+	%% write exec noend;
+
+	return hits;
+}
+
+int main()
+{
+	long len = 4000, i;
+	char *data = (char*) malloc( len + 1 );
+
+	memset( data, '.', len );
+	data[len] = 0;
+
+	/* One at the start, one across the first window boundary, one at the end. */
+	memcpy( data, "xy", 2 );
+	memcpy( data + 255, "xy", 2 );
+	memcpy( data + len - 2, "xy", 2 );
+
+	/* A false start followed by a match. */
+	memcpy( data + 1000, "xxxy", 4 );
+
+	printf( "%d\n", count( data, len ) );
+	printf( "%d\n", count( data, len - 1 ) );
+	printf( "%d\n", count( data, 0 ) );
+
+	for ( i = 0; i < len; i++ )
+		data[i] = i % 2 == 0 ? 'x' : 'y';
+	printf( "%d\n", count( data, len ) );
+
+	/* Noend runs until the action breaks out. */
+	printf( "%d\n", count_noend( data, 5 ) );
+
+	free( data );
+	return 0;
+}
+
+##### OUTPUT #####
+4
+3
+0
+2000
+5
@@ -0,0 +1,54 @@
+/*
+ * @LANG: indep
+ * @RAGEL_FLAGS: --rlhc-jobs=4
+ *
+ * The intermediate file is cut between the data definitions and translated
+ * in pieces. The output must be what translating it whole gives.
+ */
+int kw;
+
+kw = 0;
+%%{
+	machine rlhcjobs1;
+
+	action k_if { kw = 1; }
+	action k_int { kw = 2; }
+	action k_else { kw = 3; }
+	action k_while { kw = 4; }
+	action k_return { kw = 5; }
+	action k_id { kw = 6; }
+	action print {
+		print_int kw;
+		print_str "\n";
+	}
+
+	word =
+		'if' %k_if |
+		'int' %k_int |
+		'else' %k_else |
+		'while' %k_while |
+		'return' %k_return |
+		( [a-z]+ - ( 'if' | 'int' | 'else' | 'while' | 'return' ) ) %k_id;
+
+	main := ( word ' ' @print )*;
+}%%
+
+##### INPUT #####
+"if int else "
+"while return x "
+"in elsewhere iff "
+"return1 "
+##### OUTPUT #####
+1
+2
+3
+ACCEPT
+4
+5
+6
+ACCEPT
+6
+6
+6
+ACCEPT
+FAIL
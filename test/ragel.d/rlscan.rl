@@ -21,10 +21,13 @@ int _perf_dummy = 0;
 #define perf_cout(...) ( _perf_dummy += 1 )
 #define perf_loop long _pi; for ( _pi = 0; _pi < perf_iters; _pi++ )
 
+#include "perfbytes.h"
+
 #else
 
 #define perf_cout(...) __VA_ARGS__
 #define perf_loop
+#define perf_count( n )
 
 #endif
 
@@ -267,6 +270,7 @@ void test( const char *data )
 	perf_loop
 	{
 		int len = strlen( data );
+		perf_count( len );
 		const char *ts, *te;
 		int stack[1], top;
 		memset( stack, 0, sizeof(stack) );
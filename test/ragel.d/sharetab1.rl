@@ -0,0 +1,94 @@
+/*
+ * @LANG: c
+ * @RAGEL_FLAGS: --share-tables
+ * @EXPECT_CODE: ^#define _second_[a-z_]* _first_
+ * @PROHIBIT_FLAGS: --string-tables
+ *
+ * Two machines with the same tables. The second machine's tables are defined
+ * as the first's, and both must still run. String tables are not shared.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+%%{
+	machine first;
+	main := ( 'ab' | 'c' [0-9]+ )+ '\n';
+}%%
+
+%% write data;
+
+void run_first( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	if ( cs >= first_first_final )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+%%{
+	machine second;
+	main := ( 'ab' | 'c' [0-9]+ )+ '\n';
+}%%
+
+%% write data;
+
+void run_second( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	if ( cs >= second_first_final )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+%%{
+	machine third;
+	main := ( 'xy' | 'z' )+ '\n';
+}%%
+
+%% write data;
+
+void run_third( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	if ( cs >= third_first_final )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+int main()
+{
+	run_first( "abc12ab\n" );
+	run_first( "abc\n" );
+	run_second( "abc12ab\n" );
+	run_second( "abc\n" );
+	run_third( "xyzz\n" );
+	run_third( "ab\n" );
+	return 0;
+}
+
+##### OUTPUT #####
+ACCEPT
+FAIL
+ACCEPT
+FAIL
+ACCEPT
+FAIL
@@ -15,10 +15,13 @@ int _perf_dummy = 0;
 #define perf_printf(...) ( _perf_dummy += 1 )
 #define perf_loop long _pi; for ( _pi = 0; _pi < perf_iters; _pi++ )
 
+#include "perfbytes.h"
+
 #else
 
 #define perf_printf(...) printf( __VA_ARGS__ )
 #define perf_loop
+#define perf_count( n )
 
 #endif
 
@@ -155,6 +158,7 @@ void strs_run( const char *_data, int _len )
 {
 	perf_loop
 	{
+		perf_count( _len );
 		struct strs fsm;
 		const char *p = _data;
 		const char *pe = _data + _len;
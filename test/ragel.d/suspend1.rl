@@ -0,0 +1,96 @@
+/*
+ * @LANG: c
+ *
+ * A scanner suspended with write save after every few characters and resumed
+ * with write restore into a fresh buffer. Tokens that cross the pieces must
+ * come out as they do when the input is scanned in one go.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+%%{
+	machine suspend1;
+
+	main := |*
+		'foo' => { printf( "keyword\n" ); };
+		[a-z]+ => { printf( "word(%d)\n", (int)( te - ts ) ); };
+		' ';
+	*|;
+}%%
+
+%% write data;
+
+unsigned char snapshot[256];
+char buf[256];
+
+void test( const char *data, int piece )
+{
+	int cs, act, len = strlen( data ), pos, n;
+	const char *ts, *te, *p, *pe, *eof = 0;
+	long size;
+
+	for ( pos = 0; pos < len; pos += piece ) {
+		p = buf;
+		if ( pos == 0 ) {
+			%% write init;
+			pe = p;
+		}
+		else {
+			%% write restore snapshot;
+		}
+
+		n = len - pos < piece ? len - pos : piece;
+		memcpy( (char*)pe, data + pos, n );
+		pe += n;
+
+		%% write exec;
+
+		size =
+			%% write state_size;
+		;
+		if ( size > (long)sizeof(snapshot) )
+			printf( "TOO LARGE\n" );
+
+		%% write save snapshot;
+	}
+
+	p = buf;
+	%% write restore snapshot;
+	eof = pe;
+	%% write exec;
+
+	if ( cs == suspend1_error )
+		printf( "FAIL\n" );
+	else
+		printf( "ACCEPT\n" );
+	(void)act;
+}
+
+int main()
+{
+	test( "foo bar foobar fo o", 19 );
+	test( "foo bar foobar fo o", 3 );
+	test( "foo bar foobar fo o", 1 );
+	return 0;
+}
+
+##### OUTPUT #####
+keyword
+word(3)
+word(6)
+word(2)
+word(1)
+ACCEPT
+keyword
+word(3)
+word(6)
+word(2)
+word(1)
+ACCEPT
+keyword
+word(3)
+word(6)
+word(2)
+word(1)
+ACCEPT
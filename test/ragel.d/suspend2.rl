@@ -0,0 +1,90 @@
+/*
+ * @LANG: c
+ *
+ * Suspend and resume a machine that calls itself for nested parentheses. The
+ * call stack goes into the snapshot with cs and comes back on restore.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+%%{
+	machine suspend2;
+
+	paren := ( [a-z] | '(' @{ fcall paren; } )* ')' @{
+		printf( "close(%d)\n", top );
+		fret;
+	};
+
+	main := ( [a-z] | '(' @{ fcall paren; } | '\n' @{ printf( "line\n" ); } )*;
+}%%
+
+%% write data;
+
+unsigned char snapshot[256];
+char buf[256];
+
+void test( const char *data, int piece )
+{
+	int cs, stack[32], top, len = strlen( data ), pos, n;
+	const char *p, *pe;
+	long size;
+
+	for ( pos = 0; pos < len; pos += piece ) {
+		p = buf;
+		if ( pos == 0 ) {
+			%% write init;
+			pe = p;
+		}
+		else {
+			%% write restore snapshot;
+		}
+
+		n = len - pos < piece ? len - pos : piece;
+		memcpy( (char*)pe, data + pos, n );
+		pe += n;
+
+		%% write exec;
+
+		size =
+			%% write state_size;
+		;
+		if ( size > (long)sizeof(snapshot) )
+			printf( "TOO LARGE\n" );
+
+		%% write save snapshot;
+	}
+
+	if ( cs == suspend2_error )
+		printf( "FAIL\n" );
+	else
+		printf( "ACCEPT(%d)\n", top );
+}
+
+int main()
+{
+	test( "a(b(c)d)(e)\n", 12 );
+	test( "a(b(c)d)(e)\n", 5 );
+	test( "a(b(c)d)(e)\n", 1 );
+	test( "((x)\n", 1 );
+	return 0;
+}
+
+##### OUTPUT #####
+close(2)
+close(1)
+close(1)
+line
+ACCEPT(0)
+close(2)
+close(1)
+close(1)
+line
+ACCEPT(0)
+close(2)
+close(1)
+close(1)
+line
+ACCEPT(0)
+close(2)
+FAIL
@@ -0,0 +1,107 @@
+/*
+ * @LANG: c
+ *
+ * Suspend and resume a scanner over a 16 bit alphabet. Pending characters are
+ * stored low byte first, which the test checks on the last stored character.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+%%{
+	machine suspend3;
+	alphtype unsigned short;
+
+	main := |*
+		0x100..0x1ff+ => { printf( "wide(%d)\n", (int)( te - ts ) ); };
+		[a-z]+ => { printf( "word(%d)\n", (int)( te - ts ) ); };
+		' ';
+	*|;
+}%%
+
+%% write data;
+
+unsigned char snapshot[256];
+unsigned short buf[64];
+
+unsigned short data[] = {
+	'a', 'b', ' ', 0x100, 0x1a5, 0x1ff, ' ', 'c', 0x100, 0x123, 'd', ' ', 'x'
+};
+
+void test( int piece )
+{
+	int cs, act, len = sizeof(data) / sizeof(data[0]), pos, n;
+	const unsigned short *ts, *te, *p, *pe, *eof = 0;
+	long size;
+
+	for ( pos = 0; pos < len; pos += piece ) {
+		p = buf;
+		if ( pos == 0 ) {
+			%% write init;
+			pe = p;
+		}
+		else {
+			%% write restore snapshot;
+		}
+
+		n = len - pos < piece ? len - pos : piece;
+		memcpy( (unsigned short*)pe, data + pos, n * sizeof(unsigned short) );
+		pe += n;
+
+		%% write exec;
+
+		size =
+			%% write state_size;
+		;
+		if ( size > (long)sizeof(snapshot) )
+			printf( "TOO LARGE\n" );
+
+		%% write save snapshot;
+
+		if ( ts != 0 && ( snapshot[size-2] != ( pe[-1] & 0xff ) ||
+				snapshot[size-1] != ( pe[-1] >> 8 ) ) )
+			printf( "BAD ORDER\n" );
+	}
+
+	p = buf;
+	%% write restore snapshot;
+	eof = pe;
+	%% write exec;
+
+	if ( cs == suspend3_error )
+		printf( "FAIL\n" );
+	else
+		printf( "ACCEPT\n" );
+	(void)act;
+}
+
+int main()
+{
+	test( 13 );
+	test( 3 );
+	test( 1 );
+	return 0;
+}
+
+##### OUTPUT #####
+word(2)
+wide(3)
+word(1)
+wide(2)
+word(1)
+word(1)
+ACCEPT
+word(2)
+wide(3)
+word(1)
+wide(2)
+word(1)
+word(1)
+ACCEPT
+word(2)
+wide(3)
+word(1)
+wide(2)
+word(1)
+word(1)
+ACCEPT
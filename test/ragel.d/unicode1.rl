@@ -0,0 +1,91 @@
+/*
+ * @LANG: c
+ * @RAGEL_FLAGS: --utf8
+ *
+ * Code point ranges, the dot and or expressions match whole utf-8 sequences.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+%%{
+	machine unicode1;
+
+	# Capital greek letters, two bytes each.
+	greek = 0x391 .. 0x3a9;
+
+	# Spans one to four byte encodings.
+	wide = 0x7f .. 0x10000;
+
+	main := (
+		'r' greek+ |
+		'w' wide |
+		'd' /./ |
+		'o' [aé€😀] |
+		'n' [^é] |
+		't' ( 0xe9 | 0x20ac | 0x1f600 | 0x41 | 0x42 | 0x43 | 0x44 | 0x45 )
+	) '\n';
+}%%
+
+%% write data;
+
+void test( const char *data )
+{
+	int cs;
+	const char *p = data, *pe = data + strlen( data );
+
+	%% write init;
+	%% write exec;
+
+	if ( cs >= unicode1_first_final && p == pe )
+		printf( "ACCEPT\n" );
+	else
+		printf( "FAIL\n" );
+}
+
+int main()
+{
+	test( "r\xce\x91\xce\xa9\n" );
+	test( "r\xce\xb1\n" );
+	test( "w\x7f\n" );
+	test( "w\xe0\xa0\x80\n" );
+	test( "w\xf0\x90\x80\x80\n" );
+	test( "w\xf0\x90\x80\x81\n" );
+	test( "d\xe2\x82\xac\n" );
+	test( "d\xe2\x82\n" );
+	test( "d\xed\xa0\x80\n" );
+	test( "dab\n" );
+	test( "o\xc3\xa9\n" );
+	test( "o\xf0\x9f\x98\x80\n" );
+	test( "o\xc3\n" );
+	test( "ob\n" );
+	test( "n\xe2\x82\xac\n" );
+	test( "n\xc3\xa9\n" );
+	test( "t\xc3\xa9\n" );
+	test( "t\xf0\x9f\x98\x80\n" );
+	test( "tE\n" );
+	test( "t\xe9\n" );
+	return 0;
+}
+
+##### OUTPUT #####
+ACCEPT
+FAIL
+ACCEPT
+ACCEPT
+ACCEPT
+FAIL
+ACCEPT
+FAIL
+FAIL
+FAIL
+ACCEPT
+ACCEPT
+FAIL
+FAIL
+ACCEPT
+FAIL
+ACCEPT
+ACCEPT
+ACCEPT
+FAIL